@@ -0,0 +1,110 @@
+#include "aggregate.h"
+#include "stats.h"
+#include "printer.h"
+#include <cstring>
+
+// Four 64-bit lanes; GCC lowers this to whatever SIMD the target has
+typedef long long Lanes __attribute__((vector_size(32)));
+
+void minMaxTotals(const long long* data, size_t n, long long& lo, long long& hi) {
+    const size_t width = sizeof(Lanes) / sizeof(long long);
+    size_t i = 0;
+    lo = hi = data[0];
+
+    if (n >= 2 * width) {
+        Lanes vmin, vmax, v;
+        memcpy(&vmin, data, sizeof(Lanes));
+        vmax = vmin;
+        for (i = width; i + width <= n; i += width) {
+            memcpy(&v, data + i, sizeof(Lanes));  // unaligned load
+            vmin = v < vmin ? v : vmin;
+            vmax = v > vmax ? v : vmax;
+        }
+        for (size_t lane = 0; lane < width; ++lane) {
+            lo = min(lo, vmin[lane]);
+            hi = max(hi, vmax[lane]);
+        }
+    }
+    for (; i < n; ++i) {
+        lo = min(lo, data[i]);
+        hi = max(hi, data[i]);
+    }
+}
+
+TotalsColumn::TotalsColumn(const BlockDb& db, const RangeIndex& index) : heights(index.heights()) {
+    ScopedTimer timer(TIMER_INDEX_BUILD);
+    size_t n = heights.ids.size();
+    totals.resize(n);
+    prefix.resize(n + 1);
+    prefix[0] = 0;
+    for (size_t i = 0; i < n; ++i) {
+        totals[i] = db.total(heights.ids[i]);
+        prefix[i + 1] = prefix[i] + totals[i];
+    }
+}
+
+TotalsSummary TotalsColumn::summarize(long long fromHeight, long long toHeight) const {
+    TotalsSummary s;
+    pair<size_t, size_t> r = heights.range(fromHeight, toHeight);
+    s.count = r.second - r.first;
+    if (s.count == 0)
+        return s;
+
+    s.sum = prefix[r.second] - prefix[r.first];
+    s.average = (double)s.sum / s.count;
+    minMaxTotals(totals.data() + r.first, s.count, s.min, s.max);
+    return s;
+}
+
+TotalsSummary summarizeTotals(const BlockDb& db, long long fromHeight, long long toHeight) {
+    ScopedTimer timer(TIMER_LOOKUP);
+    addStat(COUNT_LOOKUPS);
+    addStat(COUNT_PROBES, db.size());
+    const int32_t* heights = db.store().heightColumn();
+    const int64_t* totals = db.store().totalColumn();
+    TotalsSummary s;
+    for (size_t i = 0; i < db.size(); ++i) {
+        if (heights[i] < fromHeight || heights[i] > toHeight)
+            continue;
+        s.min = s.count == 0 ? totals[i] : min<long long>(s.min, totals[i]);
+        s.max = s.count == 0 ? totals[i] : max<long long>(s.max, totals[i]);
+        s.sum += totals[i];
+        ++s.count;
+    }
+    if (s.count)
+        s.average = (double)s.sum / s.count;
+    return s;
+}
+
+string int128ToString(__int128 value) {
+    if (value == 0)
+        return "0";
+    bool negative = value < 0;
+    unsigned __int128 magnitude = negative ? -(unsigned __int128)value : (unsigned __int128)value;
+    string digits;
+    while (magnitude) {
+        digits += char('0' + (int)(magnitude % 10));
+        magnitude /= 10;
+    }
+    if (negative)
+        digits += '-';
+    return string(digits.rbegin(), digits.rend());
+}
+
+string formatTotalsSummary(const TotalsSummary& summary) {
+    char average[64];
+    snprintf(average, sizeof(average), "%.2f", summary.average);
+
+    string text = "blocks: " + to_string(summary.count) + "\n";
+    if (summary.count == 0)
+        return text;
+    text += "sum: " + int128ToString(summary.sum) + "\n";
+    text += "avg: " + string(average) + "\n";
+    text += "min: " + to_string(summary.min) + "\n";
+    text += "max: " + to_string(summary.max) + "\n";
+    return text;
+}
+
+void printTotalsSummary(const TotalsSummary& summary) {
+    print_output(formatTotalsSummary(summary));
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include "range.h"
+
+struct TotalsSummary {
+    size_t count = 0;
+    __int128 sum = 0;
+    long long min = 0;
+    long long max = 0;
+    double average = 0;
+};
+
+// Block totals laid out contiguously in height order, with prefix sums so a
+// height range's sum (and average) is O(1); min/max use a vectorized scan.
+class TotalsColumn {
+public:
+    TotalsColumn(const BlockDb& db, const RangeIndex& index);
+
+    TotalsSummary summarize(long long fromHeight, long long toHeight) const;
+
+private:
+    const SortedColumn& heights;
+    vector<long long> totals;   // totals[i] belongs to heights.ids[i]
+    vector<__int128> prefix;    // prefix[i] = totals[0] + ... + totals[i - 1]
+};
+
+// The same summary from one pass over the DB with nothing built, for a
+// single query
+TotalsSummary summarizeTotals(const BlockDb& db, long long fromHeight, long long toHeight);
+
+// Min and max of data[0..n), n > 0, four lanes at a time
+void minMaxTotals(const long long* data, size_t n, long long& lo, long long& hi);
+
+string int128ToString(__int128 value);
+// The lines printTotalsSummary prints
+string formatTotalsSummary(const TotalsSummary& summary);
+void printTotalsSummary(const TotalsSummary& summary);
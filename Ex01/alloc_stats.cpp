@@ -0,0 +1,50 @@
+// Counts allocations for --stats by replacing the global operator new and
+// delete. Linked into the programs that take --stats rather than built into
+// libutils.so, so nothing else that loads the library (blockd, the bench and
+// test programs, anything outside this repo) has its allocator replaced.
+#include "stats.h"
+#include <cstdlib>
+#include <new>
+
+static void* countedAlloc(std::size_t size) {
+    if (statsEnabled()) {
+        addStat(COUNT_ALLOCATIONS);
+        addStat(COUNT_ALLOCATED_BYTES, size);
+    }
+    return malloc(size ? size : 1);
+}
+
+void* operator new(std::size_t size) {
+    void* p = countedAlloc(size);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void* operator new[](std::size_t size) {
+    return operator new(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+    return countedAlloc(size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+    return countedAlloc(size);
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete[](void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+    free(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept {
+    free(p);
+}
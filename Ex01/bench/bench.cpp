@@ -0,0 +1,151 @@
+// Times the Ex01 phases against the blocks.txt in the current directory and
+// prints one JSON object per phase:
+//   {"phase": ..., "blocks": N, "runs": R, "seconds": median run,
+//    "blocks_per_sec": ..., "mb_per_sec": ..., "p50_us": ..., "p99_us": ...}
+// For bulk phases the percentiles are over runs, for lookups over single
+// lookups. Output of the measured functions goes to /dev/null.
+//
+// Usage: bench.out [runs] [lookups]
+#include "../utils.h"
+#include "../printer.h"
+#include "../block_view.h"
+#include "../blockdb.h"
+#include "../export.h"
+#include "../index.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fcntl.h>
+#include <functional>
+#include <random>
+#include <unistd.h>
+
+using namespace std;
+using Clock = chrono::steady_clock;
+
+static int realStdout = -1;
+
+// Measured code prints to stdout; park it on /dev/null while timing.
+// Reports always go to the saved descriptor.
+struct Silence {
+    Silence() {
+        cout.flush();
+        fflush(stdout);
+        int devnull = open("/dev/null", O_WRONLY);
+        dup2(devnull, STDOUT_FILENO);
+        close(devnull);
+    }
+    ~Silence() {
+        cout.flush();
+        fflush(stdout);
+        dup2(realStdout, STDOUT_FILENO);
+    }
+};
+
+static double percentile(vector<double> samples, double p) {
+    if (samples.empty())
+        return 0;
+    sort(samples.begin(), samples.end());
+    size_t i = (size_t)(p * (samples.size() - 1) + 0.5);
+    return samples[i];
+}
+
+static void report(const string& phase, size_t blocks, double bytes, const vector<double>& seconds,
+                   const vector<double>& latencies) {
+    double median = percentile(seconds, 0.5);
+    const vector<double>& spread = latencies.empty() ? seconds : latencies;
+    dprintf(realStdout, "{\"phase\": \"%s\", \"blocks\": %zu, \"runs\": %zu, \"seconds\": %.6f, "
+           "\"blocks_per_sec\": %.1f, \"mb_per_sec\": %.2f, \"p50_us\": %.3f, \"p99_us\": %.3f}\n",
+           phase.c_str(), blocks, seconds.size(), median, median > 0 ? blocks / median : 0,
+           median > 0 ? bytes / median / 1e6 : 0, percentile(spread, 0.5) * 1e6, percentile(spread, 0.99) * 1e6);
+}
+
+static double timeIt(const function<void()>& fn) {
+    Clock::time_point start = Clock::now();
+    fn();
+    return chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Runs fn `runs` times and reports the whole-run times
+static void bulkPhase(const string& phase, size_t blocks, double bytes, int runs, const function<void()>& fn) {
+    vector<double> seconds;
+    for (int r = 0; r < runs; ++r)
+        seconds.push_back(timeIt(fn));
+    report(phase, blocks, bytes, seconds, {});
+}
+
+// Times every key on its own; "blocks" in the report is the number of lookups
+static void lookupPhase(const string& phase, const vector<string>& keys, const function<void(const string&)>& fn) {
+    vector<double> latencies;
+    double total = 0;
+    for (const string& key : keys) {
+        double t = timeIt([&] { fn(key); });
+        latencies.push_back(t);
+        total += t;
+    }
+    report(phase, keys.size(), 0, {total}, latencies);
+}
+
+int main(int argc, char* argv[]) {
+    int runs = argc > 1 ? max(1, atoi(argv[1])) : 3;
+    size_t lookups = argc > 2 ? (size_t)max(1, atoi(argv[2])) : 1000;
+    realStdout = dup(STDOUT_FILENO);
+
+    BlockTextFile text;
+    if (!text.open(BLOCKS_FILE)) {
+        fprintf(stderr, "No %s in the current directory\n", BLOCKS_FILE.c_str());
+        return 1;
+    }
+    const size_t n = text.blocks().size();
+    const double bytes = (double)text.file().size();
+
+    bulkPhase("parse_views", n, bytes, runs, [&] { BlockTextFile t; t.open(BLOCKS_FILE); });
+    bulkPhase("load_db_text", n, bytes, runs, [&] {
+        remove(SNAPSHOT_FILE.c_str());
+        load_db();
+    });
+    bulkPhase("load_db_snapshot", n, bytes, runs, [&] { load_db(); });
+
+    vector<Block> blocks = load_db();
+    BlockDb db;
+    bulkPhase("blockdb_load", n, bytes, 1, [&] { db.refresh(); });
+
+    // Same random sample for every lookup phase
+    mt19937_64 rng(42);
+    vector<string> hashes, heights;
+    for (size_t i = 0; i < lookups && n > 0; ++i) {
+        const Block& b = blocks[rng() % n];
+        hashes.push_back(b.hash);
+        heights.push_back(to_string(b.height));
+    }
+    vector<string> fewHeights(heights.begin(), heights.begin() + min<size_t>(heights.size(), 50));
+
+    {
+        Silence quiet;
+        remove(INDEX_FILE.c_str());
+        findAndPrintBlockIndexed("height", heights.empty() ? "0" : heights[0]);  // builds blocks.idx
+    }
+    {
+        Silence quiet;
+        lookupPhase("lookup_hash_index", hashes, [](const string& k) { findAndPrintBlockIndexed("hash", k); });
+        lookupPhase("lookup_height_index", heights, [](const string& k) { findAndPrintBlockIndexed("height", k); });
+        lookupPhase("lookup_hash_resident", hashes, [&](const string& k) { findAndPrintBlockByField("hash", k, db); });
+        lookupPhase("lookup_height_resident", heights,
+                    [&](const string& k) { findAndPrintBlockByField("height", k, db); });
+        lookupPhase("lookup_height_scan", fewHeights,
+                    [&](const string& k) { findAndPrintBlockByField("height", k, blocks); });
+    }
+
+    {
+        Silence quiet;
+        bulkPhase("print", n, bytes, runs, [&] { printBlocks(blocks); });
+    }
+
+    bulkPhase("export_csv", n, bytes, runs, [] { exportBlocks(ExportFormat::Csv, BLOCKS_FILE, "bench.csv"); });
+    bulkPhase("export_jsonl", n, bytes, runs, [] { exportBlocks(ExportFormat::JsonLines, BLOCKS_FILE, "bench.jsonl"); });
+    bulkPhase("export_bin", n, bytes, runs, [] { exportBlocks(ExportFormat::Binary, BLOCKS_FILE, "bench.bin"); });
+    remove("bench.csv");
+    remove("bench.jsonl");
+    remove("bench.bin");
+    return 0;
+}
@@ -0,0 +1,77 @@
+// Writes a synthetic, correctly chained blocks.txt: every previous_block is
+// the hash of the next (older) record, newest block first like a refresh.
+//
+// Usage: gen_chain.out <number_of_blocks> <output_file> [seed]
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+using namespace std;
+
+static uint64_t splitmix(uint64_t& state) {
+    uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+// 64 hex chars derived from the block number; real hashes start with zeros
+static void blockHash(uint64_t seed, uint64_t n, char* out) {
+    static const char digits[] = "0123456789abcdef";
+    uint64_t state = seed ^ (n * 0xd1b54a32d192ed03ULL);
+    for (int i = 0; i < 64; i += 16) {
+        uint64_t word = splitmix(state);
+        for (int j = 0; j < 16; ++j)
+            out[i + j] = digits[(word >> (4 * j)) & 0xf];
+    }
+    for (int i = 0; i < 16; ++i)
+        out[i] = '0';
+    out[64] = '\0';
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s <number_of_blocks> <output_file> [seed]\n", argv[0]);
+        return 1;
+    }
+
+    long long count = atoll(argv[1]);
+    uint64_t seed = argc > 3 ? strtoull(argv[3], nullptr, 10) : 1;
+    FILE* out = fopen(argv[2], "w");
+    if (!out || count < 0) {
+        fprintf(stderr, "Cannot write %s\n", argv[2]);
+        return 1;
+    }
+    setvbuf(out, nullptr, _IOFBF, 1 << 20);
+
+    static const char* relays[] = {"34.68.120.7:8333", "44.202.91.3:8333", "88.99.167.175:8333",
+                                   "192.168.1.10:8333", "203.0.113.42:8333"};
+    const long long baseHeight = 800000;
+    const long long baseTime = 1690000000;  // 2023-07-22
+    uint64_t rng = seed;
+
+    char hash[65], previous[65];
+    for (long long i = count - 1; i >= 0; --i) {
+        blockHash(seed, i + 1, hash);
+        blockHash(seed, i, previous);
+
+        long long epoch = baseTime + i * 600;
+        long long days = epoch / 86400, secs = epoch % 86400;
+        // civil date from days since 1970-01-01
+        days += 719468;
+        long long era = days / 146097, doe = days - era * 146097;
+        long long yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+        long long doy = doe - (365 * yoe + yoe / 4 - yoe / 100), mp = (5 * doy + 2) / 153;
+        long long d = doy - (153 * mp + 2) / 5 + 1, m = mp < 10 ? mp + 3 : mp - 9;
+        long long y = yoe + era * 400 + (m <= 2);
+
+        uint64_t r = splitmix(rng);
+        fprintf(out,
+                "hash: %s\nheight: %lld\ntotal: %llu\ntime: %04lld-%02lld-%02lldT%02lld:%02lld:%02lldZ\n"
+                "relayed_by: %s\nprevious_block: %s\n\n",
+                hash, baseHeight + i, (unsigned long long)(r % 2000000000000000ULL), y, m, d, secs / 3600,
+                secs / 60 % 60, secs % 60, relays[(r >> 56) % 5], previous);
+    }
+    return fclose(out) == 0 ? 0 : 1;
+}
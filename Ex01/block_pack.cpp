@@ -0,0 +1,354 @@
+#include "block_pack.h"
+#include "snapshot.h"
+#include "stats.h"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <sys/mman.h>
+#include <unistd.h>
+
+static const char PACK_MAGIC[8] = {'B', 'L', 'K', 'P', 'A', 'C', 'K', '\0'};
+
+static void putVarint(string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out += char(value | 0x80);
+        value >>= 7;
+    }
+    out += char(value);
+}
+
+static void putSigned(string& out, long long value) {
+    putVarint(out, ((uint64_t)value << 1) ^ (uint64_t)(value >> 63));  // zigzag
+}
+
+static void putString(string& out, string_view text) {
+    putVarint(out, text.size());
+    out.append(text);
+}
+
+// Reads from [p, end); every read fails once the input runs out
+struct Reader {
+    const uint8_t* p;
+    const uint8_t* end;
+    bool ok = true;
+
+    uint64_t varint() {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (p >= end)
+                break;
+            uint8_t byte = *p++;
+            value |= uint64_t(byte & 0x7f) << shift;
+            if (!(byte & 0x80))
+                return value;
+        }
+        ok = false;
+        return 0;
+    }
+    long long zigzag() {
+        uint64_t v = varint();
+        return (long long)(v >> 1) ^ -(long long)(v & 1);
+    }
+    const uint8_t* bytes(size_t n) {
+        if ((size_t)(end - p) < n) {
+            ok = false;
+            return nullptr;
+        }
+        const uint8_t* at = p;
+        p += n;
+        return at;
+    }
+    string text() {
+        size_t n = varint();
+        const uint8_t* at = bytes(n);
+        return at ? string((const char*)at, n) : string();
+    }
+};
+
+// Rows [first, last) as one frame
+static string encodeFrame(const vector<BlockView>& views, const vector<uint32_t>& relayIds, size_t first,
+                          size_t last) {
+    string out;
+    out.reserve((last - first) * 48);
+    long long lastHeight = 0, lastEpoch = 0;
+    uint8_t lastPrevious[32];
+    bool haveLastPrevious = false;
+
+    for (size_t i = first; i < last; ++i) {
+        const BlockView& v = views[i];
+        uint8_t hash[32], previous[32];
+        long long epoch = 0;
+        bool timeExact = parseTime(v.time, epoch) && formatTime(epoch) == v.time;
+        bool binary = timeExact && hexToHash(v.hash, hash) && hexToHash(v.previous_block, previous);
+
+        uint8_t flags = 0;
+        if (!binary)
+            flags |= PACK_ROW_TEXT;
+        else if (haveLastPrevious && memcmp(hash, lastPrevious, 32) == 0)
+            flags |= PACK_ROW_LINKED;
+
+        out += char(flags);
+        putSigned(out, (long long)v.height - lastHeight);
+        putSigned(out, v.total);
+        putSigned(out, epoch - lastEpoch);
+        putVarint(out, relayIds[i]);
+        if (binary) {
+            if (!(flags & PACK_ROW_LINKED))
+                out.append((const char*)hash, 32);
+            out.append((const char*)previous, 32);
+            memcpy(lastPrevious, previous, 32);
+        } else {
+            putString(out, v.hash);
+            putString(out, v.time);
+            putString(out, v.previous_block);
+        }
+        haveLastPrevious = binary;
+        lastHeight = v.height;
+        lastEpoch = epoch;
+    }
+    return out;
+}
+
+// Frames encoded and written together; enough to keep every thread busy
+static const size_t WRITE_BATCH_FRAMES_PER_THREAD = 16;
+
+BlockPackWriter::BlockPackWriter(const string& path, unsigned threads, const struct stat* source)
+    : path(path), tmp(path + ".tmp." + to_string(getpid())), threads(max(threads, 1u)) {
+    memcpy(header.magic, PACK_MAGIC, sizeof(header.magic));
+    header.version = PACK_VERSION;
+    header.frameBlocks = PACK_FRAME_BLOCKS;
+    if (source) {
+        header.flags |= PACK_FROM_TEXT;
+        header.sourceSize = source->st_size;
+        header.sourceMtimeNs = mtimeNs(*source);
+        header.sourceGeneration = blocksGeneration();
+    }
+
+    // The header is filled in by finish(), once the offsets are known
+    out = fopen(tmp.c_str(), "wb");
+    ok = out && fwrite(&header, sizeof(header), 1, out) == 1;
+    offset = sizeof(header);
+}
+
+BlockPackWriter::~BlockPackWriter() {
+    if (out) {
+        fclose(out);
+        remove(tmp.c_str());
+    }
+}
+
+bool BlockPackWriter::add(const BlockView& view) {
+    auto it = relayIds.find(view.relayed_by);
+    if (it == relayIds.end()) {
+        relays.emplace_back(view.relayed_by);
+        it = relayIds.emplace(relays.back(), (uint32_t)(relays.size() - 1)).first;
+    }
+    queued.push_back(view);
+    queuedRelays.push_back(it->second);
+    ++header.count;
+    if (queued.size() >= WRITE_BATCH_FRAMES_PER_THREAD * threads * PACK_FRAME_BLOCKS)
+        flush();
+    return ok;
+}
+
+bool BlockPackWriter::flush() {
+    size_t frames = (queued.size() + PACK_FRAME_BLOCKS - 1) / PACK_FRAME_BLOCKS;
+    vector<string> encoded(frames);
+    parallelFor(frames, threads, [&](size_t first, size_t last) {
+        for (size_t f = first; f < last; ++f)
+            encoded[f] = encodeFrame(queued, queuedRelays, f * PACK_FRAME_BLOCKS,
+                                     min(queued.size(), (f + 1) * PACK_FRAME_BLOCKS));
+    });
+    for (const string& frame : encoded) {
+        offsets.push_back(offset);
+        offset += frame.size();
+        ok = ok && fwrite(frame.data(), 1, frame.size(), out) == frame.size();
+    }
+    header.frameCount += frames;
+    queued.clear();
+    queuedRelays.clear();
+    return ok;
+}
+
+bool BlockPackWriter::finish() {
+    if (!out)
+        return false;
+    flush();
+
+    string dictionary;
+    putVarint(dictionary, relays.size());
+    for (const string& relay : relays)
+        putString(dictionary, relay);
+    header.dictionaryOff = offset;
+    header.frameTableOff = offset + dictionary.size();
+    offsets.push_back(offset);
+
+    ok = ok && fwrite(dictionary.data(), 1, dictionary.size(), out) == dictionary.size();
+    ok = ok && fwrite(offsets.data(), sizeof(uint64_t), offsets.size(), out) == offsets.size();
+    ok = ok && fseek(out, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, out) == 1;
+    ok = fclose(out) == 0 && ok;
+    out = nullptr;
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+        remove(tmp.c_str());
+        return false;
+    }
+    addStat(COUNT_BYTES_WRITTEN, header.frameTableOff + offsets.size() * sizeof(uint64_t));
+    return true;
+}
+
+bool writeBlockPack(const string& path, const vector<BlockView>& views, unsigned threads) {
+    BlockPackWriter writer(path, threads);
+    for (const BlockView& view : views)
+        if (!writer.add(view))
+            return false;
+    return writer.finish();
+}
+
+bool writeBlockPack(const string& path, const vector<Block>& blocks, unsigned threads) {
+    BlockPackWriter writer(path, threads);
+    BlockView view;
+    for (const Block& b : blocks) {
+        view.hash = b.hash;
+        view.height = b.height;
+        view.total = b.total;
+        view.time = b.time;
+        view.relayed_by = b.relayed_by;
+        view.previous_block = b.previous_block;
+        if (!writer.add(view))
+            return false;
+    }
+    return writer.finish();
+}
+
+bool BlockPack::open(const string& path) {
+    count = frames = 0;
+    relays.clear();
+    header = {};
+    if (!file.open(path) || file.size() < sizeof(PackHeader))
+        return false;
+
+    PackHeader h;
+    memcpy(&h, file.data(), sizeof(h));
+    if (memcmp(h.magic, PACK_MAGIC, sizeof(h.magic)) != 0 || h.version != PACK_VERSION || h.frameBlocks == 0)
+        return false;
+    if (h.frameCount != (h.count + h.frameBlocks - 1) / h.frameBlocks || h.dictionaryOff > h.frameTableOff ||
+        h.frameTableOff > file.size() || (file.size() - h.frameTableOff) / 8 < h.frameCount + 1)
+        return false;
+
+    const uint8_t* base = (const uint8_t*)file.data();
+    Reader in{base + h.dictionaryOff, base + h.frameTableOff};
+    size_t n = in.varint();
+    for (size_t i = 0; i < n && in.ok; ++i)
+        relays.push_back(in.text());
+    if (!in.ok)
+        return false;
+
+    header = h;
+    count = h.count;
+    frames = h.frameCount;
+    blocksPerFrame = h.frameBlocks;
+    frameTable = base + h.frameTableOff;
+    return true;
+}
+
+bool BlockPack::stale() const {
+    struct stat st;
+    if (!(header.flags & PACK_FROM_TEXT) || stat(BLOCKS_FILE.c_str(), &st) != 0)
+        return false;
+    return header.sourceSize != (uint64_t)st.st_size || header.sourceMtimeNs != mtimeNs(st) ||
+           header.sourceGeneration != blocksGeneration();
+}
+
+bool BlockPack::decodeFrame(size_t f, vector<Block>& out) const {
+    if (f >= frames)
+        return false;
+    uint64_t from, to;
+    memcpy(&from, frameTable + 8 * f, 8);
+    memcpy(&to, frameTable + 8 * (f + 1), 8);
+    if (from > to || to > file.size())
+        return false;
+
+    const uint8_t* base = (const uint8_t*)file.data();
+    Reader in{base + from, base + to};
+    size_t rows = min<size_t>(blocksPerFrame, count - f * blocksPerFrame);
+    long long height = 0, epoch = 0;
+    const uint8_t* lastPrevious = nullptr;
+
+    addStat(COUNT_BLOCKS_PARSED, rows);
+    for (size_t r = 0; r < rows && in.ok; ++r) {
+        const uint8_t* flags = in.bytes(1);
+        if (!flags)
+            return false;
+        Block b;
+        height += in.zigzag();
+        b.height = (int)height;
+        b.total = in.zigzag();
+        epoch += in.zigzag();
+        uint64_t relay = in.varint();
+        if (relay >= relays.size())
+            return false;
+        b.relayed_by = relays[relay];
+
+        if (*flags & PACK_ROW_TEXT) {
+            b.hash = in.text();
+            b.time = in.text();
+            b.previous_block = in.text();
+            lastPrevious = nullptr;
+        } else {
+            const uint8_t* hash = *flags & PACK_ROW_LINKED ? lastPrevious : in.bytes(32);
+            const uint8_t* previous = in.bytes(32);
+            if (!hash || !previous)
+                return false;
+            b.hash = hashToHex(hash);
+            b.time = formatTime(epoch);
+            b.previous_block = hashToHex(previous);
+            lastPrevious = previous;
+        }
+        out.push_back(move(b));
+    }
+    return in.ok;
+}
+
+void BlockPack::release(size_t f) const {
+    if (f >= frames)
+        return;
+    uint64_t from, to;
+    memcpy(&from, frameTable + 8 * f, 8);
+    memcpy(&to, frameTable + 8 * (f + 1), 8);
+    // Only whole pages inside the frame, so neighbouring frames stay mapped
+    uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t first = ((uintptr_t)file.data() + from + page - 1) / page * page;
+    uintptr_t last = ((uintptr_t)file.data() + to) / page * page;
+    if (first < last)
+        madvise((void*)first, last - first, MADV_DONTNEED);
+}
+
+bool BlockPack::block(size_t i, Block& out) const {
+    if (i >= count)
+        return false;
+    vector<Block> frame;
+    if (!decodeFrame(i / blocksPerFrame, frame))
+        return false;
+    out = move(frame[i % blocksPerFrame]);
+    return true;
+}
+
+bool BlockPack::readAll(vector<Block>& out, unsigned threads) const {
+    ScopedTimer timer(TIMER_PARSE);
+    vector<vector<Block>> decoded(frames);
+    atomic<bool> failed(false);
+    parallelFor(frames, threads, [&](size_t first, size_t last) {
+        for (size_t f = first; f < last; ++f)
+            if (!decodeFrame(f, decoded[f]))
+                failed = true;
+    });
+    if (failed)
+        return false;
+
+    out.clear();
+    out.reserve(count);
+    for (vector<Block>& frame : decoded)
+        for (Block& b : frame)
+            out.push_back(move(b));
+    return true;
+}
@@ -0,0 +1,127 @@
+#pragma once
+#include "utils.h"
+#include "block_view.h"
+#include "mapped_file.h"
+#include <cstdio>
+#include <deque>
+#include <unordered_map>
+
+// Compressed block store ("pack"). Blocks are grouped into frames of
+// PACK_FRAME_BLOCKS that decode independently, and a frame table gives each
+// frame's offset, so one block costs one frame's decoding.
+//
+// A pack made from blocks.txt (PACK_FROM_TEXT) records that file's size,
+// mtime and generation, so a reader can tell the pack has fallen behind it.
+//
+// Layout (integers little endian):
+//   PackHeader
+//   frame[frameCount]
+//   dictionary     varint count, then varint length + bytes per relayed_by
+//   uint64_t frameOffsets[frameCount + 1]   the last one is the dictionary's
+//
+// A frame is its rows back to back. Each row:
+//   uint8  flags
+//   varint zigzag(height - previous row's height)   0 before the first row
+//   varint zigzag(total)
+//   varint zigzag(epoch - previous row's epoch)
+//   varint relayed_by dictionary id
+//   then, without PACK_ROW_TEXT:
+//     uint8[32] hash          left out with PACK_ROW_LINKED: it equals the
+//                             previous row's previous_block, as in a file
+//                             stored newest first
+//     uint8[32] previous_block
+//   or, with PACK_ROW_TEXT (hash not lowercase hex, time not in formatTime's
+//   layout), hash, time and previous_block as varint length + bytes.
+
+const uint32_t PACK_VERSION = 2;
+const uint32_t PACK_FRAME_BLOCKS = 256;
+const string PACK_FILE = "blocks.pack";
+
+const uint8_t PACK_ROW_LINKED = 1;
+const uint8_t PACK_ROW_TEXT = 2;
+
+// PackHeader::flags
+const uint64_t PACK_FROM_TEXT = 1;  // the source fields describe the blocks.txt packed
+
+struct PackHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t frameBlocks;
+    uint64_t count;
+    uint64_t frameCount;
+    uint64_t dictionaryOff;
+    uint64_t frameTableOff;
+    uint64_t flags;
+    uint64_t sourceSize;
+    int64_t sourceMtimeNs;
+    uint64_t sourceGeneration;
+};
+
+class BlockPack {
+public:
+    // Maps the file and checks its header, dictionary and frame table
+    bool open(const string& path = PACK_FILE);
+
+    size_t size() const { return count; }
+    size_t frameCount() const { return frames; }
+    size_t frameBlocks() const { return blocksPerFrame; }
+    // stat of the file as it was mapped
+    const struct stat& mappedStat() const { return file.info(); }
+    // Made from blocks.txt, which has changed since; false for a pack made
+    // from anything else, or once blocks.txt is gone
+    bool stale() const;
+
+    // Blocks of frame f appended to out; false if the frame is corrupt
+    bool decodeFrame(size_t f, vector<Block>& out) const;
+    bool block(size_t i, Block& out) const;
+    // Lets the kernel drop frame f's mapped pages (they are read back on demand)
+    void release(size_t f) const;
+    // Every block, frames decoded on threads
+    bool readAll(vector<Block>& out, unsigned threads) const;
+
+private:
+    MappedFile file;
+    size_t count = 0;
+    size_t frames = 0;
+    size_t blocksPerFrame = PACK_FRAME_BLOCKS;
+    const uint8_t* frameTable = nullptr;
+    vector<string> relays;
+    PackHeader header = {};
+};
+
+// Writes a pack as its rows arrive: once a batch of frames has filled up
+// they are encoded on threads and written out, so memory holds one batch
+// however many blocks go in. The file is written next to path and renamed
+// over it by finish(); dropping the writer before that leaves path alone.
+class BlockPackWriter {
+public:
+    // source: stat of blocks.txt when that is what is being packed
+    BlockPackWriter(const string& path, unsigned threads, const struct stat* source = nullptr);
+    ~BlockPackWriter();
+    BlockPackWriter(const BlockPackWriter&) = delete;
+    BlockPackWriter& operator=(const BlockPackWriter&) = delete;
+
+    // The view's text must stay valid until finish(). False once a write failed.
+    bool add(const BlockView& view);
+    // Writes the rest, the dictionary and the frame table, then publishes the file
+    bool finish();
+
+private:
+    bool flush();
+
+    string path, tmp;
+    unsigned threads;
+    FILE* out;
+    bool ok;
+    PackHeader header = {};
+    vector<BlockView> queued;  // rows not yet written, whole frames except at the end
+    vector<uint32_t> queuedRelays;
+    deque<string> relays;  // dictionary in order of first use; stable for relayIds' keys
+    unordered_map<string_view, uint32_t> relayIds;
+    vector<uint64_t> offsets;  // of every frame written so far
+    uint64_t offset;
+};
+
+// Every view or block through a BlockPackWriter. False if the file can't be written.
+bool writeBlockPack(const string& path, const vector<BlockView>& views, unsigned threads);
+bool writeBlockPack(const string& path, const vector<Block>& blocks, unsigned threads);
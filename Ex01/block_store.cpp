@@ -0,0 +1,204 @@
+#include "block_store.h"
+#include <cstring>
+#include <functional>
+
+static uint64_t keyOf(const uint8_t* hash) {
+    uint64_t key;
+    memcpy(&key, hash + 24, sizeof(key));  // the non-zero end of a block hash
+    return key;
+}
+
+void BlockStore::clear() {
+    hashes.clear();
+    previousHashes.clear();
+    heights.clear();
+    totals.clear();
+    epochs.clear();
+    relayIds.clear();
+    relays.clear();
+    relayLookup.clear();
+    verbatim.clear();
+}
+
+void BlockStore::reserve(size_t n) {
+    hashes.reserve(32 * n);
+    previousHashes.reserve(32 * n);
+    heights.reserve(n);
+    totals.reserve(n);
+    epochs.reserve(n);
+    relayIds.reserve(n);
+}
+
+bool BlockStore::encode(size_t i, const BlockView& view) {
+    heights[i] = view.height;
+    totals[i] = view.total;
+
+    long long epoch = 0;
+    bool exact = parseTime(view.time, epoch) && formatTime(epoch) == view.time;
+    epochs[i] = epoch;
+
+    // A hash that is not 64 lowercase hex digits is left as zeros
+    if (!hexToHash(view.hash, &hashes[32 * i])) {
+        memset(&hashes[32 * i], 0, 32);
+        exact = false;
+    }
+    if (!hexToHash(view.previous_block, &previousHashes[32 * i])) {
+        memset(&previousHashes[32 * i], 0, 32);
+        exact = false;
+    }
+    return exact;
+}
+
+bool BlockStore::findRelay(const string& relay, uint32_t& id) const {
+    auto it = relayLookup.find(relay);
+    if (it == relayLookup.end())
+        return false;
+    id = it->second;
+    return true;
+}
+
+uint32_t BlockStore::relayId(string_view relay) {
+    auto it = relayLookup.find(string(relay));
+    if (it != relayLookup.end())
+        return it->second;
+    relays.emplace_back(relay);
+    relayLookup.emplace(relays.back(), (uint32_t)(relays.size() - 1));
+    return (uint32_t)(relays.size() - 1);
+}
+
+void BlockStore::add(const BlockView& view) {
+    size_t i = size();
+    hashes.resize(32 * (i + 1));
+    previousHashes.resize(32 * (i + 1));
+    heights.resize(i + 1);
+    totals.resize(i + 1);
+    epochs.resize(i + 1);
+    relayIds.push_back(relayId(view.relayed_by));
+    if (!encode(i, view))
+        verbatim.emplace((uint32_t)i, view.toBlock());
+}
+
+void BlockStore::addAll(const vector<BlockView>& views, unsigned threads) {
+    size_t first = size();
+    size_t n = first + views.size();
+    hashes.resize(32 * n);
+    previousHashes.resize(32 * n);
+    heights.resize(n);
+    totals.resize(n);
+    epochs.resize(n);
+
+    vector<char> exact(views.size());
+    parallelFor(views.size(), threads, [&](size_t from, size_t to) {
+        for (size_t i = from; i < to; ++i)
+            exact[i] = encode(first + i, views[i]);
+    });
+
+    // The dictionary is shared, so ids are handed out in order on this thread
+    relayIds.reserve(n);
+    for (size_t i = 0; i < views.size(); ++i) {
+        relayIds.push_back(relayId(views[i].relayed_by));
+        if (!exact[i])
+            verbatim.emplace((uint32_t)(first + i), views[i].toBlock());
+    }
+}
+
+void BlockStore::prepend(const vector<BlockView>& views, unsigned threads) {
+    // Encoded into a store that starts from this one's dictionary, so the
+    // existing rows' relay ids stay valid behind the new ones
+    BlockStore front;
+    front.relays = relays;
+    front.relayLookup = relayLookup;
+    front.reserve(views.size() + size());
+    front.addAll(views, threads);
+
+    front.hashes.insert(front.hashes.end(), hashes.begin(), hashes.end());
+    front.previousHashes.insert(front.previousHashes.end(), previousHashes.begin(), previousHashes.end());
+    front.heights.insert(front.heights.end(), heights.begin(), heights.end());
+    front.totals.insert(front.totals.end(), totals.begin(), totals.end());
+    front.epochs.insert(front.epochs.end(), epochs.begin(), epochs.end());
+    front.relayIds.insert(front.relayIds.end(), relayIds.begin(), relayIds.end());
+    for (auto& row : verbatim)
+        front.verbatim.emplace(row.first + (uint32_t)views.size(), move(row.second));
+    *this = move(front);
+}
+
+const Block* BlockStore::verbatimRow(size_t i) const {
+    if (verbatim.empty())
+        return nullptr;
+    auto it = verbatim.find((uint32_t)i);
+    return it == verbatim.end() ? nullptr : &it->second;
+}
+
+bool BlockStore::hashIsBinary(size_t i) const {
+    const Block* row = verbatimRow(i);
+    uint8_t bytes[32];
+    return !row || (hexToHash(row->hash, bytes) && memcmp(bytes, hash(i), 32) == 0);
+}
+
+Block BlockStore::block(size_t i) const {
+    if (const Block* row = verbatimRow(i))
+        return *row;
+
+    Block b;
+    b.hash = hashToHex(hash(i));
+    b.height = height(i);
+    b.total = total(i);
+    b.time = formatTime(epoch(i));
+    b.relayed_by = relayedBy(i);
+    b.previous_block = hashToHex(previous(i));
+    return b;
+}
+
+uint64_t BlockStore::hashKey(string_view hex) {
+    uint8_t bytes[32];
+    if (hexToHash(hex, bytes))
+        return keyOf(bytes);
+    return std::hash<string_view>()(hex);
+}
+
+uint64_t BlockStore::hashKey(size_t i) const {
+    const Block* row = verbatimRow(i);
+    return row ? hashKey(row->hash) : keyOf(hash(i));
+}
+
+uint64_t BlockStore::previousKey(size_t i) const {
+    const Block* row = verbatimRow(i);
+    return row ? hashKey(row->previous_block) : keyOf(previous(i));
+}
+
+bool BlockStore::hashEquals(size_t i, string_view hex) const {
+    if (const Block* row = verbatimRow(i))
+        return row->hash == hex;
+    uint8_t bytes[32];
+    return hexToHash(hex, bytes) && memcmp(bytes, hash(i), 32) == 0;
+}
+
+bool BlockStore::previousEquals(size_t i, string_view hex) const {
+    if (const Block* row = verbatimRow(i))
+        return row->previous_block == hex;
+    uint8_t bytes[32];
+    return hexToHash(hex, bytes) && memcmp(bytes, previous(i), 32) == 0;
+}
+
+bool BlockStore::previousIsHashOf(size_t i, size_t j) const {
+    const Block* a = verbatimRow(i);
+    const Block* b = verbatimRow(j);
+    if (!a && !b)
+        return memcmp(previous(i), hash(j), 32) == 0;
+    if (a)
+        return hashEquals(j, a->previous_block);
+    return previousEquals(i, b->hash);
+}
+
+size_t BlockStore::memoryUsage() const {
+    size_t bytes = hashes.capacity() + previousHashes.capacity() + heights.capacity() * sizeof(int32_t) +
+                   (totals.capacity() + epochs.capacity()) * sizeof(int64_t) + relayIds.capacity() * sizeof(uint32_t);
+    for (const string& relay : relays)
+        bytes += 2 * (sizeof(string) + relay.capacity());
+    for (const auto& row : verbatim) {
+        const Block& b = row.second;
+        bytes += sizeof(row) + b.hash.capacity() + b.time.capacity() + b.relayed_by.capacity() +
+                 b.previous_block.capacity();
+    }
+    return bytes;
+}
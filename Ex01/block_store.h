@@ -0,0 +1,76 @@
+#pragma once
+#include "utils.h"
+#include "block_view.h"
+#include <unordered_map>
+
+// Blocks kept column by column in their compact form: hashes as 32 raw
+// bytes, time as epoch seconds and relayed_by as an id into a dictionary of
+// the (few) distinct relays. A row whose text would not come back byte for
+// byte from that form (hash not lowercase hex, time not in formatTime's
+// layout) is also kept verbatim, so block(i) always returns what was read.
+class BlockStore {
+public:
+    void clear();
+    void reserve(size_t n);
+
+    void add(const BlockView& view);
+    // Same as add() for each view, with the per-row encoding done on threads
+    void addAll(const vector<BlockView>& views, unsigned threads);
+    // views as rows 0..views.size() - 1, ahead of the existing rows, which
+    // are moved down without being re-encoded
+    void prepend(const vector<BlockView>& views, unsigned threads);
+
+    size_t size() const { return heights.size(); }
+    int height(size_t i) const { return heights[i]; }
+    long long total(size_t i) const { return totals[i]; }
+    long long epoch(size_t i) const { return epochs[i]; }  // 0 if the time did not parse
+    const uint8_t* hash(size_t i) const { return hashes.data() + 32 * i; }
+    const uint8_t* previous(size_t i) const { return previousHashes.data() + 32 * i; }
+    const string& relayedBy(size_t i) const { return relays[relayIds[i]]; }
+    // relayedBy(i) as an id into relay(): 0..relayCount() - 1
+    uint32_t relayIndex(size_t i) const { return relayIds[i]; }
+    size_t relayCount() const { return relays.size(); }
+    const string& relay(uint32_t id) const { return relays[id]; }
+    // False if no row has that relay
+    bool findRelay(const string& relay, uint32_t& id) const;
+
+    // The numeric columns as arrays, for scans
+    const int32_t* heightColumn() const { return heights.data(); }
+    const int64_t* totalColumn() const { return totals.data(); }
+    const int64_t* epochColumn() const { return epochs.data(); }
+    const uint32_t* relayColumn() const { return relayIds.data(); }
+    // Whether hash(i) is the row's hash, i.e. its text was lowercase hex
+    bool hashIsBinary(size_t i) const;
+
+    // Back to the text form
+    Block block(size_t i) const;
+
+    // Lookup key for a hash as text and whether row i / its previous_block has that hash
+    static uint64_t hashKey(string_view hex);
+    uint64_t hashKey(size_t i) const;
+    uint64_t previousKey(size_t i) const;
+    bool hashEquals(size_t i, string_view hex) const;
+    bool previousEquals(size_t i, string_view hex) const;
+    bool previousIsHashOf(size_t i, size_t j) const;
+
+    // Heap bytes held by the columns
+    size_t memoryUsage() const;
+
+private:
+    // Fixed-size part of a row, encodable without touching shared state
+    bool encode(size_t i, const BlockView& view);
+    uint32_t relayId(string_view relay);
+    const Block* verbatimRow(size_t i) const;
+
+    vector<uint8_t> hashes;
+    vector<uint8_t> previousHashes;
+    vector<int32_t> heights;
+    vector<int64_t> totals;
+    vector<int64_t> epochs;
+    vector<uint32_t> relayIds;
+
+    vector<string> relays;
+    unordered_map<string, uint32_t> relayLookup;
+
+    unordered_map<uint32_t, Block> verbatim;
+};
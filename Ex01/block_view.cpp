@@ -0,0 +1,128 @@
+#include "block_view.h"
+#include "stats.h"
+#include <charconv>
+#include <cstring>
+#include <cstdlib>
+
+Block BlockView::toBlock() const {
+    Block b;
+    b.hash = string(hash);
+    b.height = height;
+    b.total = total;
+    b.time = string(time);
+    b.relayed_by = string(relayed_by);
+    b.previous_block = string(previous_block);
+    return b;
+}
+
+static bool startsWith(const char* line, size_t length, const char* prefix, size_t prefixLength) {
+    return length >= prefixLength && memcmp(line, prefix, prefixLength) == 0;
+}
+
+// Same leniency as stoi/stoll: leading blanks are skipped, trailing junk ignored
+template <typename T>
+static T parseNumber(const char* p, const char* end) {
+    while (p < end && (*p == ' ' || *p == '\t'))
+        ++p;
+    T value = 0;
+    from_chars(p, end, value);
+    return value;
+}
+
+const char* parseRecordView(const char* p, const char* end, BlockView& current) {
+    while (p < end) {
+        const char* eol = static_cast<const char*>(memchr(p, '\n', end - p));
+        const char* lineEnd = eol ? eol : end;
+        const char* next = eol ? eol + 1 : end;
+        size_t length = lineEnd - p;
+
+        switch (*p) {
+        case 'h':
+            if (startsWith(p, length, "hash: ", 6))
+                current.hash = string_view(p + 6, length - 6);
+            else if (startsWith(p, length, "height: ", 8))
+                current.height = parseNumber<int>(p + 8, lineEnd);
+            break;
+        case 't':
+            if (startsWith(p, length, "total: ", 7))
+                current.total = parseNumber<long long>(p + 7, lineEnd);
+            else if (startsWith(p, length, "time: ", 6))
+                current.time = string_view(p + 6, length - 6);
+            break;
+        case 'r':
+            if (startsWith(p, length, "relayed_by: ", 12))
+                current.relayed_by = string_view(p + 12, length - 12);
+            break;
+        case 'p':
+            if (startsWith(p, length, "previous_block: ", 16)) {
+                current.previous_block = string_view(p + 16, length - 16);
+                return next;  // a record is complete once previous_block is read
+            }
+            break;
+        }
+        p = next;
+    }
+    return nullptr;
+}
+
+void parseBlockViews(const char* begin, const char* end, vector<BlockView>& out) {
+    // Records are ~230 bytes; reserving up front keeps this to one allocation
+    out.reserve(out.size() + (end - begin) / 200 + 1);
+
+    size_t before = out.size();
+    BlockView current;
+    const char* p = begin;
+    while (p < end && (p = parseRecordView(p, end, current)))
+        out.push_back(current);
+    addStat(COUNT_BLOCKS_PARSED, out.size() - before);
+}
+
+// Below this a single thread is faster than starting workers
+static const size_t PARALLEL_MIN_BYTES = 4 << 20;
+
+unsigned loadThreadCount() {
+    const char* env = getenv("BLOCKS_LOAD_THREADS");
+    if (env && atoi(env) > 0)
+        return (unsigned)atoi(env);
+    unsigned hw = thread::hardware_concurrency();
+    return hw ? hw : 1;
+}
+
+void parseBlockViewsParallel(const char* begin, const char* end, vector<BlockView>& out, unsigned threads) {
+    ScopedTimer timer(TIMER_PARSE);
+    size_t length = end - begin;
+    if (threads <= 1 || length < PARALLEL_MIN_BYTES) {
+        parseBlockViews(begin, end, out);
+        return;
+    }
+
+    // Range k starts after the first blank line at or past k * length / threads
+    vector<const char*> cuts = {begin};
+    for (unsigned k = 1; k < threads; ++k) {
+        const char* target = max(begin + length / threads * k, cuts.back());
+        const char* blank = static_cast<const char*>(memmem(target, end - target, "\n\n", 2));
+        cuts.push_back(blank ? blank + 2 : end);
+    }
+    cuts.push_back(end);
+
+    vector<vector<BlockView>> parts(threads);
+    parallelFor(threads, threads, [&](size_t first, size_t last) {
+        for (size_t k = first; k < last; ++k)
+            parseBlockViews(cuts[k], cuts[k + 1], parts[k]);
+    });
+
+    size_t total = out.size();
+    for (const vector<BlockView>& part : parts)
+        total += part.size();
+    out.reserve(total);
+    for (const vector<BlockView>& part : parts)
+        out.insert(out.end(), part.begin(), part.end());
+}
+
+bool BlockTextFile::open(const string& path) {
+    views.clear();
+    if (!mapping.open(path))
+        return false;
+    parseBlockViewsParallel(mapping.data(), mapping.data() + mapping.size(), views, loadThreadCount());
+    return true;
+}
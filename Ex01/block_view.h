@@ -0,0 +1,70 @@
+#pragma once
+#include "utils.h"
+#include "mapped_file.h"
+#include <thread>
+
+// A block whose string fields point straight into the text they were parsed
+// from, so parsing allocates nothing per field.
+struct BlockView {
+    string_view hash;
+    int height = 0;
+    long long total = 0;
+    string_view time;
+    string_view relayed_by;
+    string_view previous_block;
+
+    Block toBlock() const;
+};
+
+// Parses lines from p into current until a previous_block line completes the
+// record. Fields left out of a record keep their earlier values, like the
+// original getline loop. Returns the position after the record, or nullptr
+// if the text ends first.
+const char* parseRecordView(const char* p, const char* end, BlockView& current);
+
+// Appends every complete record in [begin, end) to out.
+void parseBlockViews(const char* begin, const char* end, vector<BlockView>& out);
+
+// The text is cut on blank lines (record boundaries) into one byte range per
+// thread and the ranges are parsed concurrently, then concatenated in file
+// order. For well-formed files the result matches parseBlockViews; a record
+// missing a field does not inherit it from a record in another range.
+void parseBlockViewsParallel(const char* begin, const char* end, vector<BlockView>& out, unsigned threads);
+
+// Worker count for loading: BLOCKS_LOAD_THREADS if set (1 disables threading),
+// otherwise the number of hardware threads.
+unsigned loadThreadCount();
+
+// Runs fn(first, last) over [0, n) split into one contiguous slice per thread.
+template <typename Fn>
+void parallelFor(size_t n, unsigned threads, Fn fn);
+
+// blocks.txt mapped into memory together with the views into it.
+class BlockTextFile {
+public:
+    bool open(const string& path = BLOCKS_FILE);
+
+    const MappedFile& file() const { return mapping; }
+    const vector<BlockView>& blocks() const { return views; }
+
+private:
+    MappedFile mapping;
+    vector<BlockView> views;
+};
+
+template <typename Fn>
+void parallelFor(size_t n, unsigned threads, Fn fn) {
+    threads = (unsigned)min<size_t>(threads, n);
+    if (threads <= 1) {
+        fn(size_t(0), n);
+        return;
+    }
+
+    vector<thread> workers;
+    size_t step = (n + threads - 1) / threads;
+    for (size_t first = step; first < n; first += step)
+        workers.emplace_back(fn, first, min(n, first + step));
+    fn(size_t(0), step);
+    for (thread& t : workers)
+        t.join();
+}
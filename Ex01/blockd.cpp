@@ -0,0 +1,461 @@
+#include "utils.h"
+#include "printer.h"
+#include "blockdb.h"
+#include "resident_indexes.h"
+#include "group_by.h"
+#include "filter.h"
+#include "export.h"
+#include "daemon.h"
+#include "block_view.h"
+#include <condition_variable>
+#include <csignal>
+#include <cstring>
+#include <climits>
+#include <cstdlib>
+#include <deque>
+#include <fcntl.h>
+#include <memory>
+#include <mutex>
+#include <poll.h>
+#include <set>
+#include <shared_mutex>
+#include <thread>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace std;
+
+// Serves q1/q2/q3 requests (see daemon.h) from a DB that stays loaded.
+// blocks.txt in the daemon's working directory is followed the way the q5
+// menu follows it: unchanged costs a stat, new records are parsed on their own.
+// Requests from clients in any other directory are declined, so they run
+// locally against their own blocks.txt.
+
+// Flushes stdout bytes to the client in frames of about this size
+static const size_t REPLY_CHUNK = 1 << 20;
+
+static string socketPath;
+
+// Written to by the signal handler; main stops when it becomes readable
+static int stopPipe[2] = {-1, -1};
+
+// One loaded state of blocks.txt and the indexes over it, never changed once
+// published. A request pins the current one and reads it without holding any
+// lock, however slowly its client takes the reply; a change to blocks.txt
+// publishes a new state and the old one goes when its last reader is done.
+struct Generation {
+    BlockDb db;
+    bool loaded = false;
+    unique_ptr<ResidentIndexes> indexes;  // over db, built as requests need them
+};
+
+struct Resident {
+    string dataDir;                   // the daemon's working directory, resolved
+    shared_mutex lock;                // guards current, the pointer only
+    shared_ptr<Generation> current;
+    mutex exporting;  // one export at a time; they share output file names
+};
+
+// Reply being written back to one client
+class Reply {
+public:
+    explicit Reply(int fd) : fd(fd) {}
+
+    void out(string_view text) {
+        buffer.append(text);
+        if (buffer.size() >= REPLY_CHUNK)
+            flush();
+    }
+    void block(const Block& b) {
+        appendBlockText(buffer, b);
+        if (buffer.size() >= REPLY_CHUNK)
+            flush();
+    }
+    void err(const string& text) {
+        flush();
+        send('e', text);
+    }
+    bool finish(int status) {
+        flush();
+        return send('x', string(1, (char)status));
+    }
+    bool decline() {
+        buffer.clear();
+        return send('u', "");
+    }
+
+private:
+    void flush() {
+        if (buffer.size() > 1)
+            send('o', string_view(buffer).substr(1));
+        buffer.assign(1, 'o');
+    }
+    bool send(char kind, string_view data) {
+        string frame(1, kind);
+        frame.append(data);
+        return ok = ok && writeFrame(fd, frame);
+    }
+
+    int fd;
+    string buffer = "o";  // kind byte, then pending stdout bytes
+    bool ok = true;
+};
+
+// The current state, brought up to date first. Seeing that blocks.txt is
+// unchanged (the usual case) takes only the shared lock; the exclusive one
+// is held just long enough to load the change and swap the pointer.
+static shared_ptr<Generation> pin(Resident& state) {
+    {
+        shared_lock<shared_mutex> read(state.lock);
+        if (state.current->db.upToDate())
+            return state.current;
+    }
+    unique_lock<shared_mutex> write(state.lock);
+    if (state.current->db.upToDate())
+        return state.current;  // another request got here first
+
+    // The next state starts from this one so refresh() only parses what
+    // changed. Nobody can pin it while we hold the lock, so if nobody else
+    // holds it either it can be taken over instead of copied.
+    shared_ptr<Generation> next = make_shared<Generation>();
+    if (state.current.use_count() == 1)
+        next->db = move(state.current->db);
+    else
+        next->db = state.current->db;
+    next->loaded = next->db.refresh();
+    next->indexes.reset(new ResidentIndexes(next->db));
+    state.current = next;
+    return next;
+}
+
+static int serveQ1(Resident& state, Reply& reply) {
+    shared_ptr<Generation> pinned = pin(state);
+    if (!pinned->loaded) {
+        reply.err("Failed to open file: " + BLOCKS_FILE + "\n");
+        return 1;
+    }
+    const BlockDb& db = pinned->db;
+    for (size_t i = 0; i < db.size(); ++i) {
+        reply.block(db.at(i));
+        if (i != db.size() - 1)
+            reply.out("|\n|\n|\nV\n");
+    }
+    return 0;
+}
+
+static int serveQ2(Resident& state, const vector<string>& args, Reply& reply) {
+    const string& option = args[0];
+    const string& value = args[1];
+    shared_ptr<Generation> pinned;
+    // Pins the current state; false (with the error sent) if blocks.txt can't be read
+    auto load = [&] {
+        pinned = pin(state);
+        if (!pinned->loaded)
+            reply.err("Failed to open file: " + BLOCKS_FILE + "\n");
+        return pinned->loaded;
+    };
+
+    if (option == "--hash" || option == "--height") {
+        if (!load())
+            return 1;
+        const BlockDb& db = pinned->db;
+        string field = option.substr(2);
+        size_t found = BlockDb::npos;
+        long long height;
+        if (field == "hash")
+            found = db.indexOfHash(value);
+        else if (parseHeight(value, height))
+            found = db.indexOfHeight(height);
+
+        if (found != BlockDb::npos)
+            reply.block(db.at(found));
+        else
+            reply.out(notFoundMessage(field, value));
+        return 0;
+    }
+
+    if (option == "--hash-prefix") {
+        long long limit = HASH_PREFIX_LIMIT;
+        if (args.size() == 3 && (!parseHeight(args[2], limit) || limit < 1)) {
+            reply.err("Invalid match limit: " + args[2] + "\n");
+            return 1;
+        }
+        bool ok;
+        if (!load())
+            return 1;
+        string text = formatHashPrefixMatches(pinned->db, pinned->indexes->prefixes(), value, limit, ok);
+        if (!ok) {
+            reply.err(text);
+            return 1;
+        }
+        reply.out(text);
+        return 0;
+    }
+
+    if (option == "--ancestor" || option == "--common-ancestor" || option == "--path") {
+        if (!load())
+            return 1;
+        bool ok;
+        string text = formatChainQuery(pinned->db, pinned->indexes->chain(), option, value, args[2], ok);
+        if (!ok) {
+            reply.err(text);
+            return 1;
+        }
+        reply.out(text);
+        return 0;
+    }
+
+    if (option == "--group-by") {
+        GroupField field;
+        long long top = 0;
+        if (!parseGroupField(value, field)) {
+            reply.err("Unknown group field: " + value + " (use relay, hour or day)\n");
+            return 1;
+        }
+        if (args.size() == 3 && (!parseHeight(args[2], top) || top < 1)) {
+            reply.err("Invalid group count: " + args[2] + "\n");
+            return 1;
+        }
+        if (!load())
+            return 1;
+        size_t groupCount;
+        vector<Group> groups = groupBlocks(pinned->db.store(), field, top, groupCount);
+        reply.out(formatGroups(groups, field, groupCount));
+        return 0;
+    }
+
+    if (option == "--where") {
+        Filter filter;
+        string error;
+        if (!filter.compile(value, error)) {
+            reply.err(error);
+            return 1;
+        }
+        if (!load())
+            return 1;
+        Selection rows = filter.select(pinned->db.store());
+        if (rows.count() == 0)
+            reply.out("No blocks match: " + value + "\n");
+        for (size_t i : rows.indexes()) {
+            reply.block(pinned->db.at(i));
+            reply.out("\n");
+        }
+        return 0;
+    }
+
+    long long lo, hi;
+    bool byTime = option == "--time-range";
+    if (!(byTime ? parseTimeRange(value, lo, hi) : parseHeightRange(value, lo, hi))) {
+        reply.err("Invalid range: " + value + "\n");
+        return 1;
+    }
+    if (!load())
+        return 1;
+
+    if (option == "--aggregate") {
+        reply.out(formatTotalsSummary(pinned->indexes->totals().summarize(lo, hi)));
+        return 0;
+    }
+
+    const RangeIndex& ranges = pinned->indexes->ranges();
+    const SortedColumn& column = byTime ? ranges.times() : ranges.heights();
+    pair<size_t, size_t> found = column.range(lo, hi);
+    if (found.first == found.second)
+        reply.out("No blocks found for " + option.substr(2) + ": " + value + "\n");
+    for (size_t i = found.first; i < found.second; ++i) {
+        reply.block(pinned->db.at(column.ids[i]));
+        reply.out("\n");
+    }
+    return 0;
+}
+
+// Only ever asked for by a client in the data directory (see serve), so the
+// file lands where the client would have written it
+static int serveQ3(Resident& state, ExportFormat format, Reply& reply) {
+    lock_guard<mutex> one(state.exporting);
+    string target = state.dataDir + "/" + exportFileName(format);
+    if (!exportBlocks(format, BLOCKS_FILE, target)) {
+        reply.err("Export to " + target + " failed\n");
+        return 1;
+    }
+    return 0;
+}
+
+// Runs one request. Returns false if the connection should be dropped.
+static bool serve(Resident& state, const string& request, int fd) {
+    vector<string> fields;
+    size_t start = 0;
+    while (true) {
+        size_t end = request.find('\0', start);
+        fields.push_back(request.substr(start, end - start));
+        if (end == string::npos)
+            break;
+        start = end + 1;
+    }
+    Reply reply(fd);
+    if (fields.size() < 2)
+        return false;
+
+    const string& program = fields[0];
+    vector<string> args(fields.begin() + 2, fields.end());
+
+    // The DB here is the data directory's blocks.txt; a client anywhere else
+    // means a different file, and its exports belong in its own directory
+    char resolved[PATH_MAX];
+    if (!realpath(fields[1].c_str(), resolved) || state.dataDir != resolved)
+        return reply.decline();
+
+    // Anything not matched here (--batch, --pack, usage errors) is
+    // left to the program, which prints its own messages
+    if (program == "q1" && args.empty())
+        return reply.finish(serveQ1(state, reply));
+    if (program == "q2" && args.size() == 2 &&
+        (args[0] == "--hash" || args[0] == "--height" || args[0] == "--height-range" ||
+         args[0] == "--time-range" || args[0] == "--aggregate" || args[0] == "--hash-prefix" ||
+         args[0] == "--group-by" || args[0] == "--where"))
+        return reply.finish(serveQ2(state, args, reply));
+    if (program == "q2" && args.size() == 3 &&
+        (args[0] == "--hash-prefix" || args[0] == "--group-by" || args[0] == "--ancestor" ||
+         args[0] == "--common-ancestor" || args[0] == "--path"))
+        return reply.finish(serveQ2(state, args, reply));
+
+    ExportFormat format = ExportFormat::Csv;
+    if (program == "q3" && (args.empty() || (args.size() == 2 && args[0] == "--format" &&
+                                             parseExportFormat(args[1], format))))
+        return reply.finish(serveQ3(state, format, reply));
+
+    return reply.decline();
+}
+
+// Connections waiting for a worker, and the ones being served
+struct ConnectionQueue {
+    mutex lock;
+    condition_variable ready;
+    deque<int> fds;
+    set<int> active;
+    bool closing = false;
+};
+
+static void worker(Resident& state, ConnectionQueue& queue) {
+    while (true) {
+        int fd;
+        {
+            unique_lock<mutex> lock(queue.lock);
+            queue.ready.wait(lock, [&] { return queue.closing || !queue.fds.empty(); });
+            if (queue.closing)
+                return;
+            fd = queue.fds.front();
+            queue.fds.pop_front();
+            queue.active.insert(fd);
+        }
+        string request;
+        while (readFrame(fd, request, DAEMON_MAX_REQUEST) && serve(state, request, fd)) {
+        }
+        {
+            lock_guard<mutex> lock(queue.lock);
+            queue.active.erase(fd);
+        }
+        close(fd);
+    }
+}
+
+// Ends every connection: queued ones are closed, and the ones being served
+// are shut down so their worker's next read or write fails and it returns
+static void closeConnections(ConnectionQueue& queue) {
+    lock_guard<mutex> lock(queue.lock);
+    queue.closing = true;
+    for (int fd : queue.fds)
+        close(fd);
+    queue.fds.clear();
+    for (int fd : queue.active)
+        shutdown(fd, SHUT_RDWR);
+    queue.ready.notify_all();
+}
+
+static void stop(int) {
+    char byte = 0;
+    if (write(stopPipe[1], &byte, 1) < 0) {
+        // Nothing to do from a signal handler; the pipe only fills if
+        // stop signals pile up, and one is enough
+    }
+}
+
+// Workers: BLOCKD_THREADS if set, otherwise the number of hardware threads
+static unsigned workerCount() {
+    const char* env = getenv("BLOCKD_THREADS");
+    int n = env ? atoi(env) : 0;
+    if (n > 0)
+        return (unsigned)n;
+    unsigned hw = thread::hardware_concurrency();
+    return hw ? hw : 4;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 2) {
+        print_error("Usage: " + string(argv[0]) + " [socket path]   (default " + DAEMON_SOCKET + ")\n");
+        return 1;
+    }
+    socketPath = argc == 2 ? argv[1] : DAEMON_SOCKET;
+
+    sockaddr_un addr = {};
+    char dataDir[PATH_MAX];
+    if (!realpath(".", dataDir)) {
+        print_error("Failed to resolve the working directory: " + string(strerror(errno)) + "\n");
+        return 1;
+    }
+    if (socketPath.size() >= sizeof(addr.sun_path)) {
+        print_error("Socket path too long: " + socketPath + "\n");
+        return 1;
+    }
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, socketPath.c_str(), socketPath.size());
+
+    Resident state;
+    state.dataDir = dataDir;
+    state.current = make_shared<Generation>();
+    if (!(state.current->loaded = state.current->db.refresh()))
+        return 1;
+    state.current->indexes.reset(new ResidentIndexes(state.current->db));
+
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    unlink(socketPath.c_str());  // left behind by a daemon that did not exit cleanly
+    if (listener < 0 || bind(listener, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(listener, 128) != 0 ||
+        pipe2(stopPipe, O_CLOEXEC | O_NONBLOCK) != 0) {
+        print_error("Failed to listen on " + socketPath + ": " + strerror(errno) + "\n");
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, stop);
+    signal(SIGTERM, stop);
+    print_output("Serving " + to_string(state.current->db.size()) + " blocks on " + socketPath + "\n");
+    cout.flush();
+
+    ConnectionQueue queue;
+    vector<thread> workers;
+    for (unsigned i = workerCount(); i > 0; --i)
+        workers.emplace_back(worker, ref(state), ref(queue));
+
+    // Accepts until a stop signal, then lets the workers finish and leaves
+    // through main so everything is torn down in order
+    pollfd waiting[2] = {{listener, POLLIN, 0}, {stopPipe[0], POLLIN, 0}};
+    while (true) {
+        if (poll(waiting, 2, -1) < 0)
+            continue;  // interrupted by a signal; the pipe says which
+        if (waiting[1].revents)
+            break;
+        int fd = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0)
+            continue;
+        lock_guard<mutex> lock(queue.lock);
+        queue.fds.push_back(fd);
+        queue.ready.notify_one();
+    }
+
+    close(listener);
+    unlink(socketPath.c_str());
+    closeConnections(queue);
+    for (thread& t : workers)
+        t.join();
+    return 0;
+}
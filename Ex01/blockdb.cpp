@@ -0,0 +1,221 @@
+#include "blockdb.h"
+#include "stats.h"
+#include "block_view.h"
+#include "printer.h"
+#include "output.h"
+#include <climits>
+#include <cstring>
+
+// How much of the already-loaded text is compared, at each end, to
+// recognise a prepend or an append
+static const size_t TAIL_CHECK_BYTES = 64;
+
+static bool sameFile(const struct stat& a, const struct stat& b) {
+    return a.st_dev == b.st_dev && a.st_ino == b.st_ino;
+}
+
+static bool sameStamp(const struct stat& a, const struct stat& b) {
+    return sameFile(a, b) && a.st_size == b.st_size &&
+           a.st_mtim.tv_sec == b.st_mtim.tv_sec && a.st_mtim.tv_nsec == b.st_mtim.tv_nsec;
+}
+
+// Offset just past the line holding this view's previous_block
+static size_t recordEnd(const MappedFile& file, const BlockView& view) {
+    size_t end = view.previous_block.data() + view.previous_block.size() - file.data();
+    return end < file.size() ? end + 1 : end;
+}
+
+void BlockDb::clear() {
+    rows.clear();
+    byHash.clear();
+    byHeight.clear();
+    loaded = {};
+    loadedGeneration = {};
+    parsedEnd = 0;
+    parsedHead.clear();
+    parsedTail.clear();
+    ++changes;
+}
+
+// Adds rows [first, size()) to the lookup maps
+void BlockDb::indexRows(size_t first) {
+    ScopedTimer timer(TIMER_INDEX_BUILD);
+    byHash.reserve(rows.size());
+    byHeight.reserve(rows.size());
+    for (size_t i = first; i < rows.size(); ++i) {
+        byHash.emplace(rows.hashKey(i), (uint32_t)i);
+        byHeight.emplace(rows.height(i), (uint32_t)i);
+    }
+}
+
+// blocks.gen is replaced by rename on every bump, so its stamp changes with
+// the count; a missing file reads as all zero
+static struct stat generationStamp() {
+    struct stat st;
+    if (stat(GENERATION_FILE.c_str(), &st) != 0)
+        st = {};
+    return st;
+}
+
+bool BlockDb::upToDate(const string& path) const {
+    struct stat st;
+    return parsedEnd > 0 && stat(path.c_str(), &st) == 0 && sameStamp(st, loaded) &&
+           sameStamp(generationStamp(), loadedGeneration);
+}
+
+bool BlockDb::loadPrepended(const MappedFile& file) {
+    // The old text, unchanged, now ends shift bytes further on
+    const char* data = file.data();
+    size_t size = file.size();
+    if (parsedEnd == 0 || size <= (size_t)loaded.st_size)
+        return false;
+    size_t shift = size - loaded.st_size;
+    if (memcmp(data + shift, parsedHead.data(), parsedHead.size()) != 0 ||
+        memcmp(data + shift + parsedEnd - parsedTail.size(), parsedTail.data(), parsedTail.size()) != 0)
+        return false;
+
+    // ... behind whole records and nothing else
+    vector<BlockView> views;
+    BlockView view;
+    const char* p = data;
+    const char* next;
+    while (p < data + shift && (next = parseRecordView(p, data + shift, view))) {
+        views.push_back(view);
+        p = next;
+        while (p < data + shift && *p == '\n')  // the blank line after a record
+            ++p;
+    }
+    if (views.empty() || p != data + shift)
+        return false;
+
+    ScopedTimer timer(TIMER_PARSE);
+    addStat(COUNT_BLOCKS_PARSED, views.size());
+    rows.prepend(views, loadThreadCount());
+    parsedEnd += shift;
+    return true;
+}
+
+bool BlockDb::refresh(const string& path) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        clear();
+        print_error("Failed to open file: " + path + "\n");
+        return false;
+    }
+    struct stat generation = generationStamp();
+    bool sameGeneration = sameStamp(generation, loadedGeneration);
+    if (parsedEnd > 0 && sameStamp(st, loaded) && sameGeneration)
+        return true;
+    // A new generation with the file looking the same means it was rewritten
+    // within the stamp's resolution; only a full reload can be trusted then
+    if (sameStamp(st, loaded))
+        parsedEnd = 0;
+
+    MappedFile file;
+    if (!file.open(path)) {
+        clear();
+        print_error("Failed to open file: " + path + "\n");
+        return false;
+    }
+    const char* data = file.data();
+    size_t size = file.size();
+
+    // An append leaves everything we parsed in place, ending with the same bytes
+    bool appended = parsedEnd > 0 && sameFile(file.info(), loaded) && size >= parsedEnd &&
+                    memcmp(data + parsedEnd - parsedTail.size(), parsedTail.data(), parsedTail.size()) == 0;
+
+    size_t first = rows.size();
+    if (!appended && loadPrepended(file)) {
+        // Every row moved, so the lookup maps start over; still far cheaper
+        // than parsing the whole file again
+        byHash.clear();
+        byHeight.clear();
+        first = 0;
+    } else if (appended) {
+        BlockView view;
+        const char* p = data + parsedEnd;
+        const char* next;
+        while (p < data + size && (next = parseRecordView(p, data + size, view))) {
+            rows.add(view);
+            addStat(COUNT_BLOCKS_PARSED);
+            parsedEnd = next - data;
+            p = next;
+        }
+    } else {
+        clear();
+        first = 0;
+        vector<BlockView> views;
+        parseBlockViewsParallel(data, data + size, views, loadThreadCount());
+        ScopedTimer timer(TIMER_PARSE);
+        rows.reserve(views.size());
+        rows.addAll(views, loadThreadCount());
+        parsedEnd = views.empty() ? 0 : recordEnd(file, views.back());
+    }
+    indexRows(first);
+    if (rows.size() > first)
+        ++changes;
+
+    size_t tail = min(parsedEnd, TAIL_CHECK_BYTES);
+    parsedHead.assign(data, tail);
+    parsedTail.assign(data + parsedEnd - tail, tail);
+    loaded = file.info();
+    loadedGeneration = generation;
+    return true;
+}
+
+size_t BlockDb::indexOfHash(const string& hash) const {
+    addStat(COUNT_LOOKUPS);
+    size_t found = npos;
+    auto range = byHash.equal_range(BlockStore::hashKey(hash));
+    for (auto it = range.first; it != range.second; ++it) {
+        addStat(COUNT_PROBES);
+        if (it->second < found && rows.hashEquals(it->second, hash))
+            found = it->second;
+    }
+    return found;
+}
+
+size_t BlockDb::indexOfHeight(long long height) const {
+    if (height < INT_MIN || height > INT_MAX)
+        return npos;
+    addStat(COUNT_LOOKUPS);
+    addStat(COUNT_PROBES);
+    auto it = byHeight.find((int)height);
+    return it == byHeight.end() ? npos : it->second;
+}
+
+size_t BlockDb::indexOfParent(size_t i) const {
+    size_t found = npos;
+    auto range = byHash.equal_range(rows.previousKey(i));
+    for (auto it = range.first; it != range.second; ++it)
+        if (it->second < found && rows.previousIsHashOf(i, it->second))
+            found = it->second;
+    return found;
+}
+
+void findAndPrintBlockByField(const string& field, const string& value, const BlockDb& db) {
+    ScopedTimer timer(TIMER_LOOKUP);
+    size_t found = BlockDb::npos;
+    long long height;
+    if (field == "hash")
+        found = db.indexOfHash(value);
+    else if (field == "height" && parseHeight(value, height))
+        found = db.indexOfHeight(height);
+
+    if (found != BlockDb::npos)
+        printBlock(db.at(found));
+    else
+        printNotFoundMessage(field, value);
+}
+
+// Same output as printBlocks(vector), one row decoded at a time
+void printBlocks(const BlockDb& db) {
+    ScopedTimer timer(TIMER_PRINT);
+    OutputBuffer out;
+    for (size_t i = 0; i < db.size() && out.ok(); ++i) {
+        out.appendBlock(db.at(i));
+        if (i != db.size() - 1) {
+            out.append("|\n|\n|\nV\n");
+        }
+    }
+}
@@ -0,0 +1,64 @@
+#pragma once
+#include "utils.h"
+#include "block_store.h"
+#include <sys/stat.h>
+#include <unordered_map>
+
+// In-memory DB that stays resident across queries (the q5 menu) and follows
+// changes to blocks.txt cheaply: unchanged files cost a stat of blocks.txt
+// and one of blocks.gen (see GENERATION_FILE), records
+// added in front (an incremental refresh) or at the end are parsed on their
+// own, anything else is reloaded in full.
+// Blocks are held in a BlockStore; at() rebuilds the text form on demand.
+class BlockDb {
+public:
+    // Brings the DB in line with the file. Returns false if it can't be read.
+    bool refresh(const string& path = BLOCKS_FILE);
+    // Whether refresh() would have nothing to do; two stats, changes nothing
+    bool upToDate(const string& path = BLOCKS_FILE) const;
+
+    // Bumped whenever refresh() changes the contents
+    unsigned long long generation() const { return changes; }
+
+    size_t size() const { return rows.size(); }
+    Block at(size_t i) const { return rows.block(i); }
+    const BlockStore& store() const { return rows; }
+    int height(size_t i) const { return rows.height(i); }
+    long long total(size_t i) const { return rows.total(i); }
+    // Block time as seconds since the epoch, parsed once at load (0 if unparsable)
+    long long epoch(size_t i) const { return rows.epoch(i); }
+
+    static const size_t npos = SIZE_MAX;
+
+    // npos if absent; the first record wins for duplicate keys
+    size_t indexOfHash(const string& hash) const;
+    size_t indexOfHeight(long long height) const;
+    // The block i's previous_block names
+    size_t indexOfParent(size_t i) const;
+
+private:
+    void clear();
+    void indexRows(size_t first);
+
+    BlockStore rows;
+    unordered_multimap<uint64_t, uint32_t> byHash;  // BlockStore::hashKey -> row
+    unordered_map<int, uint32_t> byHeight;
+
+    // Parses a run of whole records in front of what is loaded; false if
+    // data does not start that way
+    bool loadPrepended(const MappedFile& file);
+
+    // What has been loaded: identity of the file and the end of the last complete
+    // record, and of blocks.gen when it was loaded (all zero if there was none)
+    struct stat loaded {};
+    struct stat loadedGeneration {};
+    size_t parsedEnd = 0;
+    unsigned long long changes = 0;
+    // Bytes at the start and just before parsedEnd, to tell prepends and
+    // appends from rewrites
+    string parsedHead;
+    string parsedTail;
+};
+
+void findAndPrintBlockByField(const string& field, const string& value, const BlockDb& db);
+void printBlocks(const BlockDb& db);
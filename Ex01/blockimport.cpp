@@ -0,0 +1,164 @@
+#include "utils.h"
+#include "printer.h"
+#include "fetcher.h"
+#include "refresh.h"
+#include "block_pack.h"
+#include "block_view.h"
+#include "stats.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <mutex>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+// Bulk import of archived block JSON (one BlockCypher block object per file)
+// into blocks.txt or a pack. Files are read and parsed on the load threads
+// with the same top-level field extractor the fetcher uses; the blocks are
+// then written newest first, like get_blocks.sh, one per hash.
+//
+// The order is by height alone (ties by hash), not by following
+// previous_block, so where the archive holds a fork the competing blocks of
+// one height sit next to each other and q1's arrows between them do not
+// stand for parent links.
+
+// Errors listed by name before the rest are only counted
+static const size_t MAX_REPORTED_FAILURES = 10;
+
+void PrintUsage(const string& program) {
+    print_error("Usage: " + program + " <directory> [--format text|pack] [output]\n"
+                "       (default output blocks.txt or blocks.pack in the current directory)\n"
+                "       Blocks are written newest first by height; blocks of a fork are not\n"
+                "       separated from the main chain, so neighbours are not always parent and child.\n");
+}
+
+static bool listFiles(const string& dir, vector<string>& files) {
+    DIR* d = opendir(dir.c_str());
+    if (!d)
+        return false;
+    while (dirent* entry = readdir(d)) {
+        string name = entry->d_name;
+        if (name.size() > 5 && name.compare(name.size() - 5, 5, ".json") == 0)
+            files.push_back(dir + "/" + name);
+    }
+    closedir(d);
+    sort(files.begin(), files.end());  // stable order for duplicate handling
+    return true;
+}
+
+// Whole file into buffer, which is reused across calls. On failure error
+// says why (a file that shrank while being read ends early).
+static bool readFile(const string& path, string& buffer, string& error) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        error = strerror(errno);
+        return false;
+    }
+    struct stat st;
+    bool ok = fstat(fd, &st) == 0;
+    buffer.resize(ok ? st.st_size : 0);
+    size_t done = 0;
+    ssize_t n = 0;
+    while (ok && done < buffer.size()) {
+        n = read(fd, &buffer[done], buffer.size() - done);
+        ok = n > 0;
+        done += ok ? n : 0;
+    }
+    if (!ok)
+        error = n == 0 ? "unexpected end of file" : strerror(errno);
+    close(fd);
+    addStat(COUNT_BYTES_READ, done);
+    return ok;
+}
+
+int main(int argc, char* argv[]) {
+    parseStatsFlag("blockimport", argc, argv);
+
+    bool pack = false;
+    vector<string> positional;
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--format" && i + 1 < argc) {
+            string format = argv[++i];
+            if (format != "text" && format != "pack") {
+                print_error("Unknown format: " + format + "\nUse text or pack\n");
+                return 1;
+            }
+            pack = format == "pack";
+        } else {
+            positional.push_back(arg);
+        }
+    }
+    if (positional.empty() || positional.size() > 2) {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+    string output = positional.size() == 2 ? positional[1] : pack ? PACK_FILE : BLOCKS_FILE;
+
+    vector<string> files;
+    if (!listFiles(positional[0], files)) {
+        print_error("Failed to open directory: " + positional[0] + "\n");
+        return 1;
+    }
+
+    vector<Block> blocks(files.size());
+    vector<char> parsed(files.size());
+    atomic<size_t> failures(0);
+    mutex reportLock;
+    {
+        ScopedTimer timer(TIMER_PARSE);
+        parallelFor(files.size(), loadThreadCount(), [&](size_t first, size_t last) {
+            string buffer, error;
+            for (size_t i = first; i < last; ++i) {
+                bool read = readFile(files[i], buffer, error);
+                parsed[i] = read && blockFromJson(buffer, blocks[i]);
+                if (!parsed[i] && failures++ < MAX_REPORTED_FAILURES) {
+                    lock_guard<mutex> guard(reportLock);
+                    print_error("Skipping " + files[i] + (read ? ": not a block JSON file\n" : ": " + error + "\n"));
+                }
+            }
+        });
+    }
+    addStat(COUNT_BLOCKS_PARSED, files.size() - failures);
+
+    // Chain order: newest first; the first file (by name) wins for a repeated hash
+    vector<size_t> order;
+    order.reserve(files.size());
+    for (size_t i = 0; i < files.size(); ++i)
+        if (parsed[i])
+            order.push_back(i);
+    stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        if (blocks[a].height != blocks[b].height)
+            return blocks[a].height > blocks[b].height;
+        return blocks[a].hash < blocks[b].hash;
+    });
+    vector<Block> sorted;
+    sorted.reserve(order.size());
+    for (size_t i : order)
+        if (sorted.empty() || sorted.back().hash != blocks[i].hash || sorted.back().height != blocks[i].height)
+            sorted.push_back(move(blocks[i]));
+
+    // The text writers report their own failures; writeBlockPack leaves it to us
+    bool ok;
+    if (pack) {
+        ok = writeBlockPack(output, sorted, loadThreadCount());
+        if (!ok)
+            print_error("Failed to write file: " + output + "\n");
+    } else if (output == BLOCKS_FILE) {
+        ok = replaceBlocks(sorted, output);  // readers of the current blocks.txt are left undisturbed
+    } else {
+        ok = writeBlocksText(output, sorted);
+    }
+    if (!ok)
+        return 1;
+
+    string skipped = failures ? ", skipped " + to_string(failures) : "";
+    print_output("Imported " + to_string(sorted.size()) + " blocks from " + to_string(files.size()) + " files" +
+                 skipped + " into " + output + "\n");
+    return 0;
+}
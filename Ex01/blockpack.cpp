@@ -0,0 +1,149 @@
+#include "utils.h"
+#include "printer.h"
+#include "block_pack.h"
+#include "paged_store.h"
+#include "block_view.h"
+#include "output.h"
+#include "stats.h"
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+
+// Converts between blocks.txt and the compressed pack format (block_pack.h).
+
+void PrintUsage(const string& program) {
+    print_error("Usage: " + program + " pack [blocks.txt] [blocks.pack]\n"
+                "       " + program + " unpack [blocks.pack] [output.txt|-]   (default stdout)\n"
+                "       " + program + " get <index> [blocks.pack]\n");
+}
+
+// Records are parsed and handed to the writer one at a time, so memory
+// holds the writer's batch rather than a view of every block
+int Pack(const string& textPath, const string& packPath) {
+    MappedFile text;
+    if (!text.open(textPath)) {
+        print_error("Failed to open file: " + textPath + "\n");
+        return 1;
+    }
+    // Packing blocks.txt itself is recorded, so --pack can tell when it falls behind
+    BlockPackWriter writer(packPath, loadThreadCount(), textPath == BLOCKS_FILE ? &text.info() : nullptr);
+    size_t count = 0;
+    bool ok = true;
+    BlockView view;
+    const char* p = text.data();
+    const char* end = p + text.size();
+    while (ok && p < end && (p = parseRecordView(p, end, view))) {
+        ok = writer.add(view);
+        ++count;
+    }
+    addStat(COUNT_BLOCKS_PARSED, count);
+
+    // The page index too, so the first out-of-core query doesn't build it
+    if (!ok || !writer.finish() || !writePageIndex(packPath)) {
+        print_error("Failed to write file: " + packPath + "\n");
+        return 1;
+    }
+
+    struct stat st;
+    double packed = stat(packPath.c_str(), &st) == 0 ? (double)st.st_size : 0;
+    double original = (double)text.size();
+    char ratio[32];
+    snprintf(ratio, sizeof(ratio), "%.1f%%", original > 0 ? 100 * packed / original : 0);
+    print_output("Packed " + to_string(count) + " blocks: " + to_string((long long)original) + " -> " +
+                 to_string((long long)packed) + " bytes (" + ratio + ")\n");
+    return 0;
+}
+
+// Same text writeBlocksText produces, decoded a batch of frames at a time
+int Unpack(const string& packPath, const string& textPath) {
+    BlockPack pack;
+    if (!pack.open(packPath)) {
+        print_error("Not a valid pack file: " + packPath + "\n");
+        return 1;
+    }
+
+    string tmp = textPath + ".tmp." + to_string(getpid());
+    int fd = textPath == "-" ? STDOUT_FILENO : open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        print_error("Failed to write file: " + textPath + "\n");
+        return 1;
+    }
+
+    bool ok = true;
+    {
+        OutputBuffer out(fd);
+        unsigned threads = loadThreadCount();
+        size_t batch = 16 * (size_t)threads;
+        for (size_t first = 0; first < pack.frameCount() && ok; first += batch) {
+            size_t n = min(batch, pack.frameCount() - first);
+            vector<vector<Block>> frames(n);
+            vector<char> decoded(n);
+            parallelFor(n, threads, [&](size_t from, size_t to) {
+                for (size_t f = from; f < to; ++f)
+                    decoded[f] = pack.decodeFrame(first + f, frames[f]);
+            });
+            for (size_t f = 0; f < n && ok; ++f) {
+                ok = decoded[f];
+                for (const Block& block : frames[f]) {
+                    out.appendBlock(block);
+                    out.append("\n");
+                }
+            }
+        }
+        ok = out.flush() && ok;
+    }
+    if (fd == STDOUT_FILENO)
+        return ok ? 0 : 1;
+
+    ok = close(fd) == 0 && ok;
+    if (!ok || rename(tmp.c_str(), textPath.c_str()) != 0) {
+        remove(tmp.c_str());
+        print_error("Failed to unpack " + packPath + "\n");
+        return 1;
+    }
+    return 0;
+}
+
+int Get(const string& indexText, const string& packPath) {
+    long long index;
+    if (!parseHeight(indexText, index) || index < 0) {
+        print_error("Invalid index: " + indexText + "\n");
+        return 1;
+    }
+    BlockPack pack;
+    if (!pack.open(packPath)) {
+        print_error("Not a valid pack file: " + packPath + "\n");
+        return 1;
+    }
+    Block block;
+    if ((size_t)index >= pack.size()) {
+        print_output("No block at index " + indexText + " (pack holds " + to_string(pack.size()) + ")\n");
+        return 0;
+    }
+    if (!pack.block(index, block)) {
+        print_error("Corrupt frame in " + packPath + "\n");
+        return 1;
+    }
+    printBlock(block);
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    parseStatsFlag("blockpack", argc, argv);
+    if (argc < 2 || argc > 4) {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+    string command = argv[1];
+
+    if (command == "pack")
+        return Pack(argc > 2 ? argv[2] : BLOCKS_FILE, argc > 3 ? argv[3] : PACK_FILE);
+    if (command == "unpack")
+        return Unpack(argc > 2 ? argv[2] : PACK_FILE, argc > 3 ? argv[3] : "-");
+    if (command == "get" && argc >= 3)
+        return Get(argv[2], argc > 3 ? argv[3] : PACK_FILE);
+
+    PrintUsage(argv[0]);
+    return 1;
+}
@@ -0,0 +1,152 @@
+#include "chain.h"
+#include "stats.h"
+#include <algorithm>
+
+static const uint32_t NONE = UINT32_MAX;
+
+ChainIndex::ChainIndex(const BlockDb& db) {
+    ScopedTimer timer(TIMER_INDEX_BUILD);
+    size_t n = db.size();
+    vector<uint32_t> parent(n, NONE);
+    for (size_t i = 0; i < n; ++i) {
+        size_t p = db.indexOfParent(i);
+        if (p != BlockDb::npos && p != i)
+            parent[i] = (uint32_t)p;
+    }
+
+    // Depths without recursion: climb to the first known depth, then unwind.
+    // A cycle (only possible with corrupt data) is cut where it closes.
+    const uint32_t UNKNOWN = NONE, VISITING = NONE - 1;
+    depths.assign(n, UNKNOWN);
+    vector<uint32_t> stack;
+    for (size_t i = 0; i < n; ++i) {
+        uint32_t v = (uint32_t)i;
+        while (v != NONE && depths[v] == UNKNOWN) {
+            depths[v] = VISITING;
+            stack.push_back(v);
+            v = parent[v];
+        }
+        if (v != NONE && depths[v] == VISITING) {
+            parent[stack.back()] = NONE;
+            v = NONE;
+        }
+        uint32_t d = v == NONE ? 0 : depths[v] + 1;
+        while (!stack.empty()) {
+            uint32_t u = stack.back();
+            stack.pop_back();
+            depths[u] = parent[u] == NONE ? 0 : d;
+            d = depths[u] + 1;
+        }
+    }
+
+    uint32_t maxDepth = 0;
+    for (uint32_t d : depths)
+        maxDepth = max(maxDepth, d);
+    size_t levels = 1;
+    while ((1ULL << levels) <= maxDepth)
+        ++levels;
+
+    up.assign(levels, vector<uint32_t>());
+    up[0] = move(parent);
+    for (size_t j = 1; j < levels; ++j) {
+        up[j].resize(n);
+        for (size_t i = 0; i < n; ++i) {
+            uint32_t half = up[j - 1][i];
+            up[j][i] = half == NONE ? NONE : up[j - 1][half];
+        }
+    }
+}
+
+size_t ChainIndex::ancestor(size_t id, size_t k) const {
+    if (id >= depths.size() || k > depths[id])
+        return npos;
+    for (size_t j = 0; k; ++j, k >>= 1)
+        if (k & 1)
+            id = up[j][id];
+    return id;
+}
+
+size_t ChainIndex::commonAncestor(size_t a, size_t b) const {
+    if (a >= depths.size() || b >= depths.size())
+        return npos;
+    if (depths[a] < depths[b])
+        swap(a, b);
+    a = ancestor(a, depths[a] - depths[b]);
+    if (a == b)
+        return a;
+
+    for (size_t j = up.size(); j-- > 0;) {
+        if (up[j][a] != up[j][b]) {
+            a = up[j][a];
+            b = up[j][b];
+        }
+    }
+    // Different roots leave both at their roots with no shared parent
+    return up[0][a] == NONE || up[0][a] != up[0][b] ? npos : up[0][a];
+}
+
+vector<size_t> ChainIndex::path(size_t a, size_t b) const {
+    vector<size_t> result;
+    size_t top = commonAncestor(a, b);
+    if (top == npos)
+        return result;
+
+    for (size_t v = a; v != top; v = up[0][v])
+        result.push_back(v);
+    result.push_back(top);
+
+    size_t mark = result.size();
+    for (size_t v = b; v != top; v = up[0][v])
+        result.push_back(v);
+    reverse(result.begin() + mark, result.end());
+    return result;
+}
+
+vector<size_t> ChainWalk::lineage(size_t id) const {
+    vector<size_t> ids;
+    if (id >= db.size())
+        return ids;
+    vector<bool> seen(db.size());
+    while (id != npos && !seen[id]) {
+        seen[id] = true;
+        ids.push_back(id);
+        id = db.indexOfParent(id);
+    }
+    return ids;
+}
+
+size_t ChainWalk::ancestor(size_t id, size_t k) const {
+    vector<size_t> ids = lineage(id);
+    return k < ids.size() ? ids[k] : npos;
+}
+
+size_t ChainWalk::commonAncestor(size_t a, size_t b) const {
+    vector<size_t> fromA = lineage(a), fromB = lineage(b);
+    // Both end at the same root if connected; step down from it while they agree
+    size_t found = npos;
+    for (auto i = fromA.rbegin(), j = fromB.rbegin(); i != fromA.rend() && j != fromB.rend() && *i == *j; ++i, ++j)
+        found = *i;
+    return found;
+}
+
+vector<size_t> ChainWalk::path(size_t a, size_t b) const {
+    vector<size_t> result;
+    size_t top = commonAncestor(a, b);
+    if (top == npos)
+        return result;
+
+    for (size_t v : lineage(a)) {
+        result.push_back(v);
+        if (v == top)
+            break;
+    }
+    vector<size_t> fromB = lineage(b);
+    size_t mark = result.size();
+    for (size_t v : fromB) {
+        if (v == top)
+            break;
+        result.push_back(v);
+    }
+    reverse(result.begin() + mark, result.end());
+    return result;
+}
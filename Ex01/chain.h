@@ -0,0 +1,103 @@
+#pragma once
+#include "blockdb.h"
+#include "printer.h"
+
+// Ancestry over the chain formed by previous_block links. Blocks are numbered
+// by their position in the BlockDb; each keeps 2^j-th ancestor pointers
+// (binary lifting), so ancestor and common-ancestor queries take O(log n)
+// steps. A block whose previous_block is not in the DB is a root.
+class ChainIndex {
+public:
+    static const size_t npos = BlockDb::npos;
+
+    explicit ChainIndex(const BlockDb& db);
+
+    // Links from id back to its root
+    size_t depth(size_t id) const { return depths[id]; }
+
+    // k-th ancestor of id (k = 0 is id itself), npos if the DB ends first
+    size_t ancestor(size_t id, size_t k) const;
+
+    // Deepest block both a and b descend from, npos if none is in the DB
+    size_t commonAncestor(size_t a, size_t b) const;
+
+    // Blocks from a up to the common ancestor and down to b, npos-free;
+    // empty if a and b are not connected
+    vector<size_t> path(size_t a, size_t b) const;
+
+private:
+    vector<uint32_t> depths;
+    vector<vector<uint32_t>> up;  // up[j][id] = 2^j-th ancestor, NONE past the root
+};
+
+// The same queries answered by following previous_block links from the
+// blocks asked about, with nothing built up front: each costs the depth of
+// those blocks rather than the O(n log n) ChainIndex build, which only pays
+// off in a process that keeps the DB loaded and answers many queries. A
+// block that is its own parent is a root; a cycle (corrupt data) is cut
+// where the walk comes back to a block it has seen.
+class ChainWalk {
+public:
+    static const size_t npos = BlockDb::npos;
+
+    explicit ChainWalk(const BlockDb& db) : db(db) {}
+
+    size_t depth(size_t id) const { return lineage(id).size() - 1; }
+    size_t ancestor(size_t id, size_t k) const;
+    size_t commonAncestor(size_t a, size_t b) const;
+    vector<size_t> path(size_t a, size_t b) const;
+
+private:
+    // id, its parent, and so on back to the root
+    vector<size_t> lineage(size_t id) const;
+
+    const BlockDb& db;
+};
+
+// What q2 prints for --ancestor, --common-ancestor or --path (option) from
+// block hash first to second, over a ChainIndex or a ChainWalk. ok is false,
+// and the text an error, if the ancestor distance is not a number.
+template <class Chain>
+string formatChainQuery(const BlockDb& db, const Chain& chain, const string& option, const string& first,
+                        const string& second, bool& ok) {
+    ok = true;
+    size_t a = db.indexOfHash(first);
+    if (a == BlockDb::npos)
+        return notFoundMessage("hash", first);
+
+    string text;
+    if (option == "--ancestor") {
+        long long k;
+        if (!parseHeight(second, k) || k < 0) {
+            ok = false;
+            return "Invalid ancestor distance: " + second + "\n";
+        }
+        size_t found = chain.ancestor(a, k);
+        if (found == BlockDb::npos)
+            return "Block " + first + " has only " + to_string(chain.depth(a)) + " ancestors in the db\n";
+        appendBlockText(text, db.at(found));
+        return text;
+    }
+
+    size_t b = db.indexOfHash(second);
+    if (b == BlockDb::npos)
+        return notFoundMessage("hash", second);
+
+    if (option == "--common-ancestor") {
+        size_t found = chain.commonAncestor(a, b);
+        if (found == BlockDb::npos)
+            return "No common ancestor in the db\n";
+        appendBlockText(text, db.at(found));
+        return text;
+    }
+
+    vector<size_t> path = chain.path(a, b);
+    if (path.empty())
+        return "No path between the blocks in the db\n";
+    for (size_t i = 0; i < path.size(); ++i) {
+        if (i)
+            text += "|\n|\n|\nV\n";  // as printBlocks links them
+        appendBlockText(text, db.at(path[i]));
+    }
+    return text;
+}
@@ -0,0 +1,123 @@
+#include "daemon.h"
+#include "printer.h"
+#include <cerrno>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static bool writeAll(int fd, const char* data, size_t length) {
+    while (length > 0) {
+        ssize_t n = send(fd, data, length, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        data += n;
+        length -= n;
+    }
+    return true;
+}
+
+static bool readAll(int fd, char* data, size_t length) {
+    while (length > 0) {
+        ssize_t n = read(fd, data, length);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        data += n;
+        length -= n;
+    }
+    return true;
+}
+
+bool writeFrame(int fd, string_view payload) {
+    uint32_t length = (uint32_t)payload.size();
+    unsigned char header[4] = {(unsigned char)length, (unsigned char)(length >> 8), (unsigned char)(length >> 16),
+                               (unsigned char)(length >> 24)};
+    return writeAll(fd, (const char*)header, sizeof(header)) && writeAll(fd, payload.data(), payload.size());
+}
+
+bool readFrame(int fd, string& payload, uint32_t limit) {
+    unsigned char header[4];
+    if (!readAll(fd, (char*)header, sizeof(header)))
+        return false;
+    uint32_t length = header[0] | header[1] << 8 | header[2] << 16 | (uint32_t)header[3] << 24;
+    if (length > limit)
+        return false;
+    payload.resize(length);
+    return readAll(fd, &payload[0], length);
+}
+
+string daemonSocketPath() {
+    const char* env = getenv("BLOCKS_DAEMON_SOCKET");
+    return env ? env : "";
+}
+
+// Output relayed for the daemon goes straight to the descriptors, after
+// anything the program itself has buffered
+static void relay(int fd, string_view data) {
+    size_t done = 0;
+    while (done < data.size()) {
+        ssize_t n = write(fd, data.data() + done, data.size() - done);
+        if (n <= 0)
+            return;
+        done += n;
+    }
+}
+
+bool runThroughDaemon(const string& program, int argc, char* argv[], int& exitCode) {
+    string path = daemonSocketPath();
+    sockaddr_un addr = {};
+    if (path.empty() || path.size() >= sizeof(addr.sun_path))
+        return false;
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path.c_str(), path.size());
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return false;
+    if (connect(fd, (sockaddr*)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return false;
+    }
+
+    char cwd[4096];
+    string request = program;
+    request += '\0';
+    request += getcwd(cwd, sizeof(cwd)) ? cwd : ".";
+    for (int i = 1; i < argc; ++i) {
+        request += '\0';
+        request += argv[i];
+    }
+
+    cout.flush();
+    fflush(stdout);
+    bool served = false, relayed = false;
+    string frame;
+    if (writeFrame(fd, request)) {
+        while (readFrame(fd, frame) && !frame.empty()) {
+            string_view data = string_view(frame).substr(1);
+            if (frame[0] == 'o' || frame[0] == 'e') {
+                relay(frame[0] == 'o' ? STDOUT_FILENO : STDERR_FILENO, data);
+                relayed = true;
+            } else {
+                if (frame[0] == 'x' && !data.empty()) {
+                    exitCode = (unsigned char)data[0];
+                    served = true;
+                }
+                break;
+            }
+        }
+    }
+    close(fd);
+
+    // Part of the answer is already out; running it again would repeat it
+    if (!served && relayed) {
+        print_error("Lost connection to the block daemon\n");
+        exitCode = 1;
+        served = true;
+    }
+    return served;
+}
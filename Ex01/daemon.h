@@ -0,0 +1,31 @@
+#pragma once
+#include "utils.h"
+
+// Protocol between blockd.out and the programs that route through it.
+//
+// Everything travels in frames: a uint32 payload length (little endian)
+// followed by the payload. A request is one frame holding NUL-separated
+// fields: program name ("q1", "q2", "q3"), the client's working directory,
+// then the program's arguments. The reply is a run of frames whose first
+// payload byte says what the rest is:
+//   'o'  bytes for the client's stdout
+//   'e'  bytes for the client's stderr
+//   'x'  end of reply; the next byte is the exit status
+//   'u'  end of reply; the daemon does not serve this request and the
+//        client should run it locally
+// A connection may carry any number of requests, one after the other.
+
+const string DAEMON_SOCKET = "blocks.sock";
+const uint32_t DAEMON_MAX_REQUEST = 1 << 20;
+
+bool writeFrame(int fd, string_view payload);
+// False on EOF, a read error or a frame longer than limit
+bool readFrame(int fd, string& payload, uint32_t limit = UINT32_MAX);
+
+// Socket path from BLOCKS_DAEMON_SOCKET, empty if routing is off
+string daemonSocketPath();
+
+// Sends the invocation to the daemon and relays its reply. Returns false if
+// routing is off, the daemon can't be reached or declines the request;
+// the caller then does the work itself.
+bool runThroughDaemon(const string& program, int argc, char* argv[], int& exitCode);
@@ -0,0 +1,282 @@
+#include "export.h"
+#include "stats.h"
+#include "block_view.h"
+#include "printer.h"
+#include "blockdb.h"
+#include "filter.h"
+#include "json_fields.h"
+#include <charconv>
+#include <condition_variable>
+#include <cstring>
+#include <fcntl.h>
+#include <mutex>
+#include <sys/uio.h>
+#include <unistd.h>
+
+static const size_t EXPORT_CHUNK_BYTES = 8 << 20;
+static const size_t MAX_IOVECS = 64;
+
+bool parseExportFormat(const string& name, ExportFormat& format) {
+    if (name == "csv")
+        format = ExportFormat::Csv;
+    else if (name == "jsonl" || name == "json")
+        format = ExportFormat::JsonLines;
+    else if (name == "bin" || name == "binary")
+        format = ExportFormat::Binary;
+    else
+        return false;
+    return true;
+}
+
+string exportFileName(ExportFormat format) {
+    switch (format) {
+    case ExportFormat::JsonLines:
+        return "blocks.jsonl";
+    case ExportFormat::Binary:
+        return "blocks.bin";
+    default:
+        return "blocks.csv";
+    }
+}
+
+template <typename T>
+static void appendNumber(string& out, T value) {
+    char buf[24];
+    char* end = to_chars(buf, buf + sizeof(buf), value).ptr;
+    out.append(buf, end);
+}
+
+template <typename T>
+static void appendRaw(string& out, T value) {
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+static void appendCsvField(string& out, string_view field) {
+    if (field.find_first_of(",\"\r\n") == string_view::npos) {
+        out.append(field);
+        return;
+    }
+    out += '"';
+    for (char c : field) {
+        if (c == '"')
+            out += '"';
+        out += c;
+    }
+    out += '"';
+}
+
+static void appendBinaryString(string& out, string_view field) {
+    appendRaw<uint32_t>(out, (uint32_t)field.size());
+    out.append(field);
+}
+
+static void formatBlock(string& out, const BlockView& b, ExportFormat format) {
+    switch (format) {
+    case ExportFormat::Csv:
+        appendCsvField(out, b.hash);
+        out += ',';
+        appendNumber(out, b.height);
+        out += ',';
+        appendNumber(out, b.total);
+        out += ',';
+        appendCsvField(out, b.time);
+        out += ',';
+        appendCsvField(out, b.relayed_by);
+        out += ',';
+        appendCsvField(out, b.previous_block);
+        out += '\n';
+        break;
+    case ExportFormat::JsonLines:
+        out += "{\"hash\":";
+        appendJsonString(out, b.hash);
+        out += ",\"height\":";
+        appendNumber(out, b.height);
+        out += ",\"total\":";
+        appendNumber(out, b.total);
+        out += ",\"time\":";
+        appendJsonString(out, b.time);
+        out += ",\"relayed_by\":";
+        appendJsonString(out, b.relayed_by);
+        out += ",\"previous_block\":";
+        appendJsonString(out, b.previous_block);
+        out += "}\n";
+        break;
+    case ExportFormat::Binary:
+        appendRaw<int32_t>(out, b.height);
+        appendRaw<int64_t>(out, b.total);
+        appendBinaryString(out, b.hash);
+        appendBinaryString(out, b.time);
+        appendBinaryString(out, b.relayed_by);
+        appendBinaryString(out, b.previous_block);
+        break;
+    }
+}
+
+static string formatHeader(ExportFormat format) {
+    string out;
+    if (format == ExportFormat::Csv) {
+        out = "hash,height,total,time,relayed_by,previous_block\n";
+    } else if (format == ExportFormat::Binary) {
+        out.assign("BLKEXP\0\0", 8);
+        appendRaw<uint32_t>(out, EXPORT_BINARY_VERSION);
+    }
+    return out;
+}
+
+static bool writeAll(int fd, vector<iovec>& iov) {
+    size_t first = 0;
+    while (first < iov.size()) {
+        ssize_t n = writev(fd, &iov[first], (int)min(iov.size() - first, MAX_IOVECS));
+        if (n < 0)
+            return false;
+        addStat(COUNT_BYTES_WRITTEN, n);
+        // Skip what was written, possibly stopping inside a buffer
+        while (first < iov.size() && (size_t)n >= iov[first].iov_len) {
+            n -= iov[first].iov_len;
+            ++first;
+        }
+        if (first < iov.size()) {
+            iov[first].iov_base = static_cast<char*>(iov[first].iov_base) + n;
+            iov[first].iov_len -= n;
+        }
+    }
+    return true;
+}
+
+bool exportBlocks(ExportFormat format, const string& inputPath, const string& outputPath) {
+    ScopedTimer timer(TIMER_EXPORT);
+    MappedFile input;
+    string target = outputPath.empty() ? exportFileName(format) : outputPath;
+    int fd = -1;
+    if (input.open(inputPath))
+        fd = open(target.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        print_error("Error opening input or output file!\n");
+        return false;
+    }
+
+    // Chunk k covers [cuts[k], cuts[k + 1]); every cut follows a blank line
+    const char* begin = input.data();
+    const char* end = begin + input.size();
+    vector<const char*> cuts = {begin};
+    while (cuts.back() < end) {
+        const char* stop = cuts.back() + min<size_t>(EXPORT_CHUNK_BYTES, end - cuts.back());
+        const char* blank = stop < end ? static_cast<const char*>(memmem(stop, end - stop, "\n\n", 2)) : nullptr;
+        cuts.push_back(blank ? blank + 2 : end);
+    }
+    size_t chunkCount = cuts.size() - 1;
+
+    unsigned threads = loadThreadCount();
+    size_t window = 2 * (size_t)threads;  // formatted chunks allowed ahead of the writer
+
+    vector<string> output(chunkCount);
+    vector<char> ready(chunkCount, 0);
+    size_t nextChunk = 0, written = 0;
+    mutex lock;
+    condition_variable changed;
+
+    auto worker = [&]() {
+        while (true) {
+            size_t k;
+            {
+                unique_lock<mutex> guard(lock);
+                changed.wait(guard, [&] { return nextChunk >= chunkCount || nextChunk < written + window; });
+                if (nextChunk >= chunkCount)
+                    return;
+                k = nextChunk++;
+            }
+
+            vector<BlockView> views;
+            parseBlockViews(cuts[k], cuts[k + 1], views);
+            string out;
+            out.reserve((cuts[k + 1] - cuts[k]) + (cuts[k + 1] - cuts[k]) / 4);
+            for (const BlockView& view : views)
+                formatBlock(out, view, format);
+
+            lock_guard<mutex> guard(lock);
+            output[k] = move(out);
+            ready[k] = 1;
+            changed.notify_all();
+        }
+    };
+
+    vector<thread> workers;
+    for (unsigned i = 0; i < threads; ++i)
+        workers.emplace_back(worker);
+
+    string header = formatHeader(format);
+    vector<iovec> iov;
+    if (!header.empty())
+        iov.push_back({header.data(), header.size()});
+
+    bool ok = true;
+    while (written < chunkCount) {
+        size_t last;
+        {
+            unique_lock<mutex> guard(lock);
+            changed.wait(guard, [&] { return ready[written]; });
+            last = written;
+            while (last < chunkCount && ready[last] && last - written < MAX_IOVECS)
+                ++last;
+        }
+
+        // The chunks in [written, last) are finished and no worker touches them
+        for (size_t k = written; k < last; ++k)
+            if (!output[k].empty())
+                iov.push_back({output[k].data(), output[k].size()});
+        ok = ok && writeAll(fd, iov);
+        iov.clear();
+
+        lock_guard<mutex> guard(lock);
+        for (size_t k = written; k < last; ++k)
+            string().swap(output[k]);
+        written = last;
+        changed.notify_all();
+    }
+    if (!iov.empty())
+        ok = ok && writeAll(fd, iov);  // header of an empty export
+
+    for (thread& t : workers)
+        t.join();
+
+    ok = (close(fd) == 0) && ok;
+    if (!ok)
+        print_error("Error writing " + target + "\n");
+    return ok;
+}
+
+bool exportSelection(ExportFormat format, const BlockDb& db, const Selection& rows, const string& outputPath) {
+    ScopedTimer timer(TIMER_EXPORT);
+    string target = outputPath.empty() ? exportFileName(format) : outputPath;
+    int fd = open(target.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        print_error("Error opening input or output file!\n");
+        return false;
+    }
+
+    string out = formatHeader(format);
+    bool ok = true;
+    for (size_t i : rows.indexes()) {
+        Block b = db.at(i);
+        BlockView view;
+        view.hash = b.hash;
+        view.height = b.height;
+        view.total = b.total;
+        view.time = b.time;
+        view.relayed_by = b.relayed_by;
+        view.previous_block = b.previous_block;
+        formatBlock(out, view, format);
+        if (out.size() >= EXPORT_CHUNK_BYTES) {
+            vector<iovec> iov = {{out.data(), out.size()}};
+            ok = ok && writeAll(fd, iov);
+            out.clear();
+        }
+    }
+    vector<iovec> iov = {{out.data(), out.size()}};
+    ok = ok && writeAll(fd, iov);
+
+    ok = (close(fd) == 0) && ok;
+    if (!ok)
+        print_error("Error writing " + target + "\n");
+    return ok;
+}
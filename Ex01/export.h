@@ -0,0 +1,32 @@
+#pragma once
+#include "utils.h"
+
+// Streaming export of blocks.txt.
+//
+// The input is mapped and cut on record boundaries into fixed-size chunks.
+// Worker threads parse and format chunks in parallel while the calling
+// thread writes finished chunks in file order with writev. Only a bounded
+// window of chunks is in flight, so memory use does not grow with the DB.
+//
+// Formats:
+//   csv    header line, then one line per block; fields holding a comma,
+//          quote or line break are quoted RFC 4180 style
+//   jsonl  one JSON object per line
+//   bin    "BLKEXP\0\0", uint32 version, then per block: int32 height,
+//          int64 total, and hash, time, relayed_by, previous_block each as
+//          uint32 length + bytes (little endian)
+
+enum class ExportFormat { Csv, JsonLines, Binary };
+
+const uint32_t EXPORT_BINARY_VERSION = 1;
+
+bool parseExportFormat(const string& name, ExportFormat& format);
+string exportFileName(ExportFormat format);
+
+// Writes every block of inputPath to outputPath (exportFileName() if empty).
+bool exportBlocks(ExportFormat format, const string& inputPath = BLOCKS_FILE, const string& outputPath = "");
+
+class BlockDb;
+class Selection;
+// Same output, for only the rows of db a filter selected
+bool exportSelection(ExportFormat format, const BlockDb& db, const Selection& rows, const string& outputPath = "");
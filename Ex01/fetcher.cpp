@@ -0,0 +1,209 @@
+#include "fetcher.h"
+#include "http.h"
+#include "json_fields.h"
+#include "printer.h"
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cstdlib>
+#include <ctime>
+#include <mutex>
+#include <thread>
+
+static const char* DEFAULT_API_URL = "https://api.blockcypher.com/v1/btc/main";
+static const int FETCH_ATTEMPTS = 5;
+// Longest Retry-After honoured; a server asking for more is treated as failed
+static const int MAX_RETRY_AFTER_SECONDS = 120;
+
+string apiBaseUrl() {
+    const char* env = getenv("BLOCKS_API_URL");
+    string url = env && *env ? env : DEFAULT_API_URL;
+    while (!url.empty() && url.back() == '/')
+        url.pop_back();
+    return url;
+}
+
+static bool haveToken() {
+    const char* token = getenv("BLOCKS_API_TOKEN");
+    return token && *token;
+}
+
+static string withToken(const string& url) {
+    return haveToken() ? url + "?token=" + getenv("BLOCKS_API_TOKEN") : url;
+}
+
+static unsigned fetchConcurrency() {
+    const char* env = getenv("BLOCKS_FETCH_CONCURRENCY");
+    return env && atoi(env) > 0 ? (unsigned)atoi(env) : haveToken() ? 8 : 2;
+}
+
+// Shared by every fetching thread: when the next request may start
+class RequestPacer {
+public:
+    RequestPacer() {
+        const char* env = getenv("BLOCKS_FETCH_RATE");
+        double rate = env && *env ? atof(env) : haveToken() ? 0 : 3;
+        if (rate > 0)
+            interval = chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(1 / rate));
+    }
+
+    void wait() {
+        unique_lock<mutex> lock(m);
+        auto start = max(chrono::steady_clock::now(), next);
+        next = start + interval;
+        lock.unlock();
+        this_thread::sleep_until(start);
+    }
+
+    // No request starts for the next delay
+    void holdOff(chrono::steady_clock::duration delay) {
+        lock_guard<mutex> lock(m);
+        next = max(next, chrono::steady_clock::now() + delay);
+    }
+
+private:
+    mutex m;
+    chrono::steady_clock::duration interval {};
+    chrono::steady_clock::time_point next {};
+};
+
+static RequestPacer& pacer() {
+    static RequestPacer instance;
+    return instance;
+}
+
+// Seconds to wait from a Retry-After header (delta-seconds or an HTTP date);
+// -1 if there is none or it can't be read
+static long long retryAfterSeconds(const HttpHeaders& headers) {
+    for (const auto& header : headers) {
+        if (header.first != "retry-after")
+            continue;
+        const string& value = header.second;
+        long long seconds;
+        auto parsed = from_chars(value.data(), value.data() + value.size(), seconds);
+        if (parsed.ec == errc() && parsed.ptr == value.data() + value.size())
+            return max(0LL, seconds);
+        tm date = {};
+        const char* end = strptime(value.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &date);
+        if (end && *end == '\0')
+            return max<long long>(0, timegm(&date) - time(nullptr));
+    }
+    return -1;
+}
+
+// GET with retries. Rate limiting (429) and unavailability (503) wait as long
+// as the server asks; those and other server errors otherwise back off.
+static bool getJson(const string& url, string& body, string& error) {
+    chrono::milliseconds backoff(0);
+    for (int attempt = 0; attempt < FETCH_ATTEMPTS; ++attempt) {
+        if (attempt > 0)
+            this_thread::sleep_for(backoff);
+        backoff = chrono::milliseconds(1000 << attempt);
+        pacer().wait();
+
+        int status = 0;
+        HttpHeaders headers;
+        if (!httpGet(withToken(url), status, body, error, &headers))
+            continue;
+        if (status == 200)
+            return true;
+        error = "HTTP " + to_string(status) + " from " + url;
+        if (status != 429 && status < 500)
+            return false;
+
+        long long wait = status == 429 || status == 503 ? retryAfterSeconds(headers) : -1;
+        if (wait > MAX_RETRY_AFTER_SECONDS)
+            return false;
+        if (wait >= 0) {
+            pacer().holdOff(chrono::seconds(wait));
+            backoff = chrono::milliseconds(0);
+        }
+    }
+    return false;
+}
+
+bool blockFromJson(string_view json, Block& block) {
+    string_view hash, height, total, time, relayedBy, previous;
+    if (!jsonField(json, "hash", hash) || !jsonField(json, "height", height))
+        return false;
+    jsonField(json, "total", total);
+    jsonField(json, "time", time);
+    jsonField(json, "relayed_by", relayedBy);
+    jsonField(json, "prev_block", previous);
+
+    // Numbers straight from the text, as atoi/atoll would read them
+    block.height = 0;
+    block.total = 0;
+    from_chars(height.data(), height.data() + height.size(), block.height);
+    from_chars(total.data(), total.data() + total.size(), block.total);
+    block.hash = string(hash);
+    block.time = string(time);
+    block.relayed_by = string(relayedBy);
+    block.previous_block = string(previous);
+    return true;
+}
+
+bool fetchTipHeight(long long& height) {
+    string body, error;
+    string_view value;
+    if (!getJson(apiBaseUrl(), body, error)) {
+        print_error("Failed to fetch chain tip: " + error + "\n");
+        return false;
+    }
+    if (!jsonField(body, "height", value)) {
+        print_error("Chain tip response has no height\n");
+        return false;
+    }
+    height = atoll(string(value).c_str());
+    return true;
+}
+
+bool fetchBlocksByHeight(const vector<long long>& heights, vector<Block>& blocks, atomic<size_t>* fetched) {
+    blocks.assign(heights.size(), Block());
+    atomic<size_t> next(0);
+    atomic<bool> failed(false);
+    string firstError;  // written only by the worker that sets failed
+    string base = apiBaseUrl();
+
+    auto worker = [&]() {
+        string body, error;
+        size_t i;
+        while (!failed && (i = next++) < heights.size()) {
+            string url = base + "/blocks/" + to_string(heights[i]);
+            error.clear();
+            if (!getJson(url, body, error) || !blockFromJson(body, blocks[i])) {
+                if (error.empty())
+                    error = "unexpected block JSON from " + url;
+                if (!failed.exchange(true))
+                    firstError = "Failed to fetch block " + to_string(heights[i]) + ": " + error + "\n";
+            } else if (fetched) {
+                ++*fetched;
+            }
+        }
+    };
+
+    vector<thread> workers;
+    unsigned count = (unsigned)min<size_t>(fetchConcurrency(), heights.size());
+    for (unsigned i = 0; i < count; ++i)
+        workers.emplace_back(worker);
+    for (thread& t : workers)
+        t.join();
+    // Reported here rather than by the worker so that an ErrorCapture held
+    // by the caller sees it
+    if (failed)
+        print_error(firstError);
+    return !failed;
+}
+
+bool fetchLatestBlocks(int numBlocks, vector<Block>& blocks, atomic<size_t>* fetched) {
+    long long tip;
+    if (numBlocks <= 0 || !fetchTipHeight(tip)) {
+        blocks.clear();
+        return numBlocks <= 0;
+    }
+
+    vector<long long> heights;
+    for (long long h = tip; h > tip - numBlocks && h >= 0; --h)
+        heights.push_back(h);
+    return fetchBlocksByHeight(heights, blocks, fetched);
+}
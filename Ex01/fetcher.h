@@ -0,0 +1,33 @@
+#pragma once
+#include "utils.h"
+#include <atomic>
+
+// Native replacement for get_blocks.sh. Blocks are requested by height from a
+// BlockCypher-compatible API with a bounded number of requests in flight.
+//
+// Environment:
+//   BLOCKS_API_URL            base URL (default https://api.blockcypher.com/v1/btc/main);
+//                             "<base>" must return the chain tip, "<base>/blocks/<height>" a block
+//   BLOCKS_API_TOKEN          optional API token, sent as ?token=
+//   BLOCKS_FETCH_CONCURRENCY  requests in flight (default 8 with a token, 2 without)
+//   BLOCKS_FETCH_RATE         requests started per second, 0 for no limit
+//                             (default 3 without a token, BlockCypher's
+//                             unauthenticated limit; no limit with one)
+//
+// A 429 or 503 answer is retried after the Retry-After delay it carries,
+// which holds back every worker, not just the one that was refused.
+
+string apiBaseUrl();
+
+bool blockFromJson(string_view json, Block& block);
+
+bool fetchTipHeight(long long& height);
+
+// blocks[i] receives heights[i]. Failed requests are retried with backoff;
+// returns false if any height could not be fetched. fetched, if given, is
+// bumped as each block arrives.
+bool fetchBlocksByHeight(const vector<long long>& heights, vector<Block>& blocks,
+                         atomic<size_t>* fetched = nullptr);
+
+// The newest numBlocks blocks, newest first (the order get_blocks.sh wrote).
+bool fetchLatestBlocks(int numBlocks, vector<Block>& blocks, atomic<size_t>* fetched = nullptr);
@@ -0,0 +1,381 @@
+#include "filter.h"
+#include "range.h"
+#include "stats.h"
+#include <algorithm>
+#include <cctype>
+#include <climits>
+#include <cmath>
+#include <cstring>
+
+// Multiplying eight 0/1 bytes by this leaves byte k's bit as bit 56 + k
+static const uint64_t PACK_BYTES = 0x0102040810204080ULL;
+
+Selection::Selection(size_t rows, bool set) : n(rows), words((rows + 63) / 64, set ? ~0ULL : 0) {
+    clearTail();
+}
+
+void Selection::clearTail() {
+    if (n % 64)
+        words.back() &= (1ULL << (n % 64)) - 1;
+}
+
+size_t Selection::count() const {
+    size_t total = 0;
+    for (uint64_t w : words)
+        total += __builtin_popcountll(w);
+    return total;
+}
+
+vector<size_t> Selection::indexes() const {
+    vector<size_t> out;
+    out.reserve(count());
+    for (size_t w = 0; w < words.size(); ++w)
+        for (uint64_t bits = words[w]; bits; bits &= bits - 1)
+            out.push_back(64 * w + __builtin_ctzll(bits));
+    return out;
+}
+
+Selection& Selection::operator&=(const Selection& other) {
+    for (size_t w = 0; w < words.size(); ++w)
+        words[w] &= other.words[w];
+    return *this;
+}
+
+Selection& Selection::operator|=(const Selection& other) {
+    for (size_t w = 0; w < words.size(); ++w)
+        words[w] |= other.words[w];
+    return *this;
+}
+
+void Selection::flip() {
+    for (uint64_t& w : words)
+        w = ~w;
+    clearTail();
+}
+
+// Rows of column whose value lies in [lo, hi] (lo <= hi). Comparing v - lo
+// with hi - lo as unsigned tests both bounds at once, so a block of 64 rows
+// is one compare per row into a byte array the compiler vectorizes, then
+// eight multiplies to pack the bytes into the word.
+template <typename T>
+static void scanRange(const T* column, size_t n, long long lo, long long hi, uint64_t* words) {
+    const uint64_t span = (uint64_t)hi - (uint64_t)lo;
+    uint8_t hits[64];
+    for (size_t base = 0; base < n; base += 64) {
+        if (n - base >= 64) {
+            for (size_t j = 0; j < 64; ++j)
+                hits[j] = (uint64_t)(long long)column[base + j] - (uint64_t)lo <= span;
+        } else {
+            memset(hits, 0, sizeof(hits));
+            for (size_t j = 0; j < n - base; ++j)
+                hits[j] = (uint64_t)(long long)column[base + j] - (uint64_t)lo <= span;
+        }
+        uint64_t bits = 0;
+        for (size_t k = 0; k < 8; ++k) {
+            uint64_t eight;
+            memcpy(&eight, hits + 8 * k, 8);
+            bits |= (eight * PACK_BYTES >> 56) << (8 * k);
+        }
+        words[base / 64] = bits;
+    }
+}
+
+Selection Filter::run(const BlockStore& store, size_t id) const {
+    const Node& node = nodes[id];
+    size_t n = store.size();
+
+    if (node.kind == Kind::And || node.kind == Kind::Or) {
+        Selection rows = run(store, node.left);
+        Selection other = run(store, node.right);
+        return node.kind == Kind::And ? rows &= other : rows |= other;
+    }
+    if (node.kind == Kind::Not) {
+        Selection rows = run(store, node.left);
+        rows.flip();
+        return rows;
+    }
+
+    Selection rows(n);
+    addStat(COUNT_PROBES, n);
+    if (node.kind == Kind::Range && node.lo <= node.hi) {
+        if (node.column == Column::Height)
+            scanRange(store.heightColumn(), n, node.lo, node.hi, rows.data());
+        else if (node.column == Column::Total)
+            scanRange(store.totalColumn(), n, node.lo, node.hi, rows.data());
+        else
+            scanRange(store.epochColumn(), n, node.lo, node.hi, rows.data());
+    } else if (node.kind == Kind::Text) {
+        uint32_t relay;
+        if (node.column == Column::Relay) {
+            // Equal to a relay means equal to its dictionary id
+            if (store.findRelay(node.text, relay))
+                scanRange(store.relayColumn(), n, relay, relay, rows.data());
+        } else {
+            uint64_t key = BlockStore::hashKey(node.text);
+            bool previous = node.column == Column::Previous;
+            uint64_t* words = rows.data();
+            for (size_t i = 0; i < n; ++i) {
+                bool match = previous ? store.previousKey(i) == key && store.previousEquals(i, node.text)
+                                      : store.hashKey(i) == key && store.hashEquals(i, node.text);
+                words[i / 64] |= (uint64_t)match << (i % 64);
+            }
+        }
+    }
+    if (node.negate)
+        rows.flip();
+    return rows;
+}
+
+Selection Filter::select(const BlockStore& store) const {
+    ScopedTimer timer(TIMER_LOOKUP);
+    addStat(COUNT_LOOKUPS);
+    return run(store, root);
+}
+
+// Recursive descent over the tokens of one expression, appending to the
+// filter's nodes as it goes
+class FilterParser {
+public:
+    FilterParser(const string& text, Filter& filter) : text(text), filter(filter) {}
+
+    bool parse(string& error) {
+        next();
+        if (!failed && token.empty() && !quoted)
+            fail("Empty filter");
+        if (!failed)
+            filter.root = parseOr();
+        if (!failed && (!token.empty() || quoted))
+            fail("Unexpected '" + token + "'");
+        error = message;
+        return !failed;
+    }
+
+private:
+    typedef Filter::Node Node;
+    typedef Filter::Kind Kind;
+    typedef Filter::Column Column;
+
+    // Reads the next token into token: a parenthesis, an operator, a quoted
+    // string (quoted set) or a bare word; empty at the end of the text
+    void next() {
+        token.clear();
+        quoted = false;
+        while (pos < text.size() && isspace((unsigned char)text[pos]))
+            ++pos;
+        if (pos == text.size())
+            return;
+
+        char c = text[pos];
+        if (c == '(' || c == ')') {
+            token = c;
+            ++pos;
+        } else if (strchr("=!<>", c)) {
+            while (pos < text.size() && strchr("=!<>", text[pos]))
+                token += text[pos++];
+        } else if (c == '\'' || c == '"') {
+            size_t close = text.find(c, pos + 1);
+            if (close == string::npos) {
+                fail("Unterminated string");
+                pos = text.size();
+                return;
+            }
+            token = text.substr(pos + 1, close - pos - 1);
+            quoted = true;
+            pos = close + 1;
+        } else {
+            while (pos < text.size() && !isspace((unsigned char)text[pos]) && !strchr("()=!<>'\"", text[pos]))
+                token += text[pos++];
+        }
+    }
+
+    bool keyword(const char* word) const {
+        if (quoted || token.size() != strlen(word))
+            return false;
+        for (size_t i = 0; i < token.size(); ++i)
+            if (toupper((unsigned char)token[i]) != word[i])
+                return false;
+        return true;
+    }
+
+    void fail(const string& what) {
+        if (!failed)
+            message = what + "\n";
+        failed = true;
+    }
+
+    size_t add(const Node& node) {
+        filter.nodes.push_back(node);
+        return filter.nodes.size() - 1;
+    }
+
+    size_t combine(Kind kind, size_t left, size_t right) {
+        Node node;
+        node.kind = kind;
+        node.left = left;
+        node.right = right;
+        return add(node);
+    }
+
+    size_t parseOr() {
+        size_t left = parseAnd();
+        while (!failed && keyword("OR")) {
+            next();
+            left = combine(Kind::Or, left, parseAnd());
+        }
+        return left;
+    }
+
+    size_t parseAnd() {
+        size_t left = parseUnary();
+        while (!failed && keyword("AND")) {
+            next();
+            left = combine(Kind::And, left, parseUnary());
+        }
+        return left;
+    }
+
+    size_t parseUnary() {
+        if (failed)
+            return 0;
+        if (keyword("NOT")) {
+            next();
+            return combine(Kind::Not, parseUnary(), 0);
+        }
+        if (token == "(" && !quoted) {
+            next();
+            size_t inner = parseOr();
+            if (!failed && (token != ")" || quoted))
+                fail("Missing ')'");
+            next();
+            return inner;
+        }
+        return parseComparison();
+    }
+
+    bool parseNumber(const string& value, long long& out) {
+        if (value.find_first_of(".eE") == string::npos) {
+            try {
+                size_t used;
+                out = stoll(value, &used);
+                return used == value.size();
+            } catch (const exception&) {
+                return false;
+            }
+        }
+        // 1e12, 2.5e9: fine as long as the value is whole
+        char* end;
+        double d = strtod(value.c_str(), &end);
+        if (end != value.c_str() + value.size() || d != floor(d) || fabs(d) >= 9.2e18)
+            return false;
+        out = (long long)d;
+        return true;
+    }
+
+    bool parseValue(Column column, long long& out) {
+        string value = token;
+        if (failed || (value.empty() && !quoted)) {
+            fail("Expected a value");
+            return false;
+        }
+        next();
+        if (column == Column::Time ? parseTimeValue(value, out) : parseNumber(value, out))
+            return true;
+        fail("Invalid " + string(column == Column::Time ? "time" : "number") + ": " + value);
+        return false;
+    }
+
+    size_t parseComparison() {
+        string field = token;
+        Node node;
+        static const pair<const char*, Column> fields[] = {
+            {"height", Column::Height},     {"total", Column::Total}, {"time", Column::Time},
+            {"relayed_by", Column::Relay}, {"hash", Column::Hash},   {"previous_block", Column::Previous}};
+        bool known = false;
+        for (const auto& f : fields)
+            if (!quoted && field == f.first) {
+                node.column = f.second;
+                known = true;
+            }
+        if (!known) {
+            fail(field.empty() && !quoted ? "Expected a field" : "Unknown field: " + field);
+            return 0;
+        }
+        next();
+
+        bool textual = node.column == Column::Relay || node.column == Column::Hash || node.column == Column::Previous;
+        if (keyword("BETWEEN")) {
+            if (textual) {
+                fail("BETWEEN does not apply to " + field);
+                return 0;
+            }
+            next();
+            node.kind = Kind::Range;
+            if (!parseValue(node.column, node.lo))
+                return 0;
+            if (!keyword("AND")) {
+                fail("Expected AND in BETWEEN");
+                return 0;
+            }
+            next();
+            parseValue(node.column, node.hi);
+            return add(node);
+        }
+
+        string op = quoted ? "" : token;
+        if (op != "=" && op != "==" && op != "!=" && op != "<>" && op != "<" && op != "<=" && op != ">" &&
+            op != ">=") {
+            fail("Expected a comparison after " + field);
+            return 0;
+        }
+        next();
+        node.negate = op == "!=" || op == "<>";
+
+        if (textual) {
+            if (op != "=" && op != "==" && !node.negate) {
+                fail("Only = and != apply to " + field);
+                return 0;
+            }
+            if (token.empty() && !quoted) {
+                fail("Expected a value");
+                return 0;
+            }
+            node.kind = Kind::Text;
+            node.text = token;
+            next();
+            return add(node);
+        }
+
+        long long value;
+        if (!parseValue(node.column, value))
+            return 0;
+        node.kind = Kind::Range;
+        node.lo = LLONG_MIN;
+        node.hi = LLONG_MAX;
+        if (op == "<")
+            node.hi = value == LLONG_MIN ? (node.lo = 0, -1) : value - 1;
+        else if (op == "<=")
+            node.hi = value;
+        else if (op == ">")
+            node.lo = value == LLONG_MAX ? (node.hi = -1, 0) : value + 1;
+        else if (op == ">=")
+            node.lo = value;
+        else
+            node.lo = node.hi = value;
+        return add(node);
+    }
+
+    const string& text;
+    Filter& filter;
+    size_t pos = 0;
+    string token;
+    bool quoted = false;
+    bool failed = false;
+    string message;
+};
+
+bool Filter::compile(const string& text, string& error) {
+    nodes.clear();
+    root = 0;
+    FilterParser parser(text, *this);
+    return parser.parse(error);
+}
@@ -0,0 +1,74 @@
+#pragma once
+#include "blockdb.h"
+
+// Ad-hoc block filters such as
+//
+//   total > 1e12 AND relayed_by = 1.2.3.4:8333 AND height BETWEEN 850000 AND 850100
+//
+// Grammar (keywords in any case):
+//   expr       := and (OR and)*
+//   and        := unary (AND unary)*
+//   unary      := NOT unary | '(' expr ')' | comparison
+//   comparison := field op value | field BETWEEN value AND value
+//   op         := = == != <> < <= > >=
+// Fields: height, total, time (epoch seconds, YYYY-MM-DD or ISO time),
+// relayed_by, hash and previous_block; the last three take only = and !=.
+// Values are bare words or 'quoted' / "quoted" text; numbers may be written
+// as 1e12 as long as they are whole.
+//
+// Every comparison on a numeric column (or on relayed_by, through its
+// dictionary id) becomes an inclusive range test, run as a branchless scan
+// 64 rows at a time that fills a Selection; AND, OR and NOT then combine
+// selections a word at a time.
+
+// One bit per row of a BlockStore
+class Selection {
+public:
+    explicit Selection(size_t rows = 0, bool set = false);
+
+    size_t rows() const { return n; }
+    bool test(size_t i) const { return words[i / 64] >> (i % 64) & 1; }
+    size_t count() const;
+    // Set rows in ascending order
+    vector<size_t> indexes() const;
+
+    Selection& operator&=(const Selection& other);
+    Selection& operator|=(const Selection& other);
+    void flip();
+
+    uint64_t* data() { return words.data(); }
+
+private:
+    void clearTail();
+
+    size_t n;
+    vector<uint64_t> words;
+};
+
+class Filter {
+public:
+    // False with a message in error if text does not parse
+    bool compile(const string& text, string& error);
+
+    Selection select(const BlockStore& store) const;
+
+private:
+    enum class Column { Height, Total, Time, Relay, Hash, Previous };
+    enum class Kind { And, Or, Not, Range, Text };
+
+    struct Node {
+        Kind kind;
+        size_t left = 0, right = 0;  // children, by position in nodes
+        Column column = Column::Height;
+        long long lo = 0, hi = 0;    // Range: inclusive bounds
+        string text;                 // Text: the value it must equal
+        bool negate = false;         // Range/Text: select the rows that do not match
+    };
+
+    Selection run(const BlockStore& store, size_t node) const;
+
+    vector<Node> nodes;
+    size_t root = 0;
+
+    friend class FilterParser;
+};
@@ -3,9 +3,13 @@
 # Number of blocks to fetch from the first argument
 NUM_BLOCKS=$1
 OUTPUT_FILE="blocks.txt"
+GENERATION_FILE="blocks.gen"
 
-# Clear or create output file
-> "$OUTPUT_FILE"
+# Build the new DB beside the old one; readers keep using the old file until
+# it is swapped in at the end
+TMP_FILE="$OUTPUT_FILE.tmp.$$"
+trap 'rm -f "$TMP_FILE"' EXIT
+> "$TMP_FILE"
 
 # Get the latest block hash
 LATEST_HASH=$(wget -qO- "https://api.blockcypher.com/v1/btc/main" | grep -oP '"hash":\s*"\K[^"]+')
@@ -36,8 +40,20 @@ do
       echo "relayed_by: $RELAYED_BY"
       echo "previous_block: $PREV_BLOCK"
       echo ""
-    } >> "$OUTPUT_FILE"
+    } >> "$TMP_FILE"
 
     # Move to the previous block
     CURRENT_HASH=$PREV_BLOCK
 done
+
+# Publish: rename over blocks.txt and bump the generation counter, holding the
+# same lock the programs take so an append can't land in the replaced file
+touch "$OUTPUT_FILE"
+if command -v flock > /dev/null; then
+    exec 9< "$OUTPUT_FILE"
+    flock 9
+fi
+mv -f "$TMP_FILE" "$OUTPUT_FILE"
+GENERATION=$(cat "$GENERATION_FILE" 2>/dev/null || echo 0)
+echo $((GENERATION + 1)) > "$GENERATION_FILE.tmp.$$"
+mv -f "$GENERATION_FILE.tmp.$$" "$GENERATION_FILE"
@@ -0,0 +1,117 @@
+#include "group_by.h"
+#include "aggregate.h"
+#include "printer.h"
+#include "stats.h"
+#include <algorithm>
+#include <climits>
+#include <unordered_map>
+
+static const long long HOUR_SECONDS = 3600;
+static const long long DAY_SECONDS = 24 * HOUR_SECONDS;
+// Bucket of the rows whose time did not parse
+static const long long UNKNOWN_BUCKET = LLONG_MIN;
+
+bool parseGroupField(const string& name, GroupField& field) {
+    if (name == "relay" || name == "relayed_by")
+        field = GroupField::Relay;
+    else if (name == "hour")
+        field = GroupField::Hour;
+    else if (name == "day")
+        field = GroupField::Day;
+    else
+        return false;
+    return true;
+}
+
+static long long bucketStart(long long epoch, long long width) {
+    long long offset = epoch % width;
+    return epoch - (offset < 0 ? offset + width : offset);
+}
+
+static string bucketName(long long start, GroupField field) {
+    if (start == UNKNOWN_BUCKET)
+        return UNKNOWN_GROUP;
+    string time = formatTime(start);  // YYYY-MM-DDTHH:MM:SSZ
+    if (field == GroupField::Day)
+        return time.substr(0, 10);
+    return time.substr(0, 13) + ":00Z";
+}
+
+// Largest volume first; ties by more blocks, then key order
+static bool byVolume(const Group& a, const Group& b) {
+    if (a.volume != b.volume)
+        return a.volume > b.volume;
+    if (a.blocks != b.blocks)
+        return a.blocks > b.blocks;
+    return a.start < b.start;
+}
+
+vector<Group> groupBlocks(const BlockStore& store, GroupField field, size_t top, size_t& groupCount) {
+    ScopedTimer timer(TIMER_LOOKUP);
+    vector<Group> groups;
+
+    if (field == GroupField::Relay) {
+        // The dictionary already numbers the relays densely
+        groups.resize(store.relayCount());
+        for (size_t i = 0; i < store.size(); ++i) {
+            Group& g = groups[store.relayIndex(i)];
+            ++g.blocks;
+            g.volume += store.total(i);
+        }
+        for (uint32_t id = 0; id < groups.size(); ++id) {
+            groups[id].key = store.relay(id).empty() ? NO_RELAY_GROUP : store.relay(id);
+            groups[id].start = id;
+        }
+    } else {
+        long long width = field == GroupField::Day ? DAY_SECONDS : HOUR_SECONDS;
+        unordered_map<long long, size_t> slots;  // bucket start -> groups index
+        for (size_t i = 0; i < store.size(); ++i) {
+            long long epoch = store.epoch(i);
+            long long start = epoch == 0 ? UNKNOWN_BUCKET : bucketStart(epoch, width);
+            auto it = slots.emplace(start, groups.size()).first;
+            if (it->second == groups.size()) {
+                groups.emplace_back();
+                groups.back().start = start;
+            }
+            Group& g = groups[it->second];
+            ++g.blocks;
+            g.volume += store.total(i);
+        }
+        addStat(COUNT_PROBES, store.size());
+        for (Group& g : groups)
+            g.key = bucketName(g.start, field);
+    }
+
+    groupCount = groups.size();
+    if (top > 0 && top < groups.size()) {
+        partial_sort(groups.begin(), groups.begin() + top, groups.end(), byVolume);
+        groups.resize(top);
+    } else if (top > 0 || field == GroupField::Relay) {
+        sort(groups.begin(), groups.end(), byVolume);
+    } else {
+        sort(groups.begin(), groups.end(), [](const Group& a, const Group& b) { return a.start < b.start; });
+    }
+    return groups;
+}
+
+string formatGroups(const vector<Group>& groups, GroupField field, size_t groupCount) {
+    const char* name = field == GroupField::Relay ? "relayed_by" : field == GroupField::Hour ? "hour" : "day";
+    string text = "groups by " + string(name) + ": " + to_string(groupCount);
+    if (groups.size() < groupCount)
+        text += " (top " + to_string(groups.size()) + " by volume)";
+    text += "\n";
+
+    size_t width = 0;
+    for (const Group& g : groups)
+        width = max(width, g.key.size());
+    for (const Group& g : groups) {
+        text += g.key;
+        text.append(width - g.key.size() + 2, ' ');
+        text += "blocks: " + to_string(g.blocks) + "  volume: " + int128ToString(g.volume) + "\n";
+    }
+    return text;
+}
+
+void printGroups(const vector<Group>& groups, GroupField field, size_t groupCount) {
+    print_output(formatGroups(groups, field, groupCount));
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include "blockdb.h"
+
+// Block counts and total volume per relay, per hour or per day, built in
+// one pass over the BlockStore columns. Relays are aggregated by their
+// dictionary id; hours and days by a hash table keyed on the bucket start.
+enum class GroupField { Relay, Hour, Day };
+
+bool parseGroupField(const string& name, GroupField& field);
+
+struct Group {
+    string key;         // the relay, or the bucket as "YYYY-MM-DD[THH:00Z]"
+    long long start;    // bucket start in epoch seconds (relay id for Relay)
+    size_t blocks = 0;
+    __int128 volume = 0;  // sum of the blocks' totals
+};
+
+// Rows with an unparsable time (epoch 0) go to one group keyed "unknown"
+const string UNKNOWN_GROUP = "unknown";
+// and blocks with an empty relayed_by to one keyed "(none)"
+const string NO_RELAY_GROUP = "(none)";
+
+// Every group, or with top > 0 only the top groups by volume (partial sort).
+// Without a top, relays come by volume and time buckets in time order.
+// groupCount gets the number of groups before the cut.
+vector<Group> groupBlocks(const BlockStore& store, GroupField field, size_t top, size_t& groupCount);
+
+// One "key  blocks: N  volume: V" line per group, after a header line
+string formatGroups(const vector<Group>& groups, GroupField field, size_t groupCount);
+void printGroups(const vector<Group>& groups, GroupField field, size_t groupCount);
@@ -0,0 +1,95 @@
+#include "hash_prefix.h"
+#include "stats.h"
+#include "printer.h"
+#include <algorithm>
+#include <cstring>
+
+HashPrefixIndex::HashPrefixIndex(const BlockDb& db) : store(db.store()) {
+    ScopedTimer timer(TIMER_INDEX_BUILD);
+    ids.reserve(db.size());
+    for (size_t i = 0; i < db.size(); ++i)
+        if (store.hashIsBinary(i))
+            ids.push_back((uint32_t)i);
+    sortIds();
+}
+
+HashPrefixIndex::HashPrefixIndex(const BlockDb& db, const string& prefix) : store(db.store()) {
+    ScopedTimer timer(TIMER_INDEX_BUILD);
+    uint8_t low[32], high[32];
+    if (!prefixBounds(prefix, low, high))
+        return;
+    for (size_t i = 0; i < db.size(); ++i)
+        if (memcmp(store.hash(i), low, 32) >= 0 && memcmp(store.hash(i), high, 32) <= 0 && store.hashIsBinary(i))
+            ids.push_back((uint32_t)i);
+    sortIds();
+}
+
+void HashPrefixIndex::sortIds() {
+    auto less = [&](uint32_t a, uint32_t b) { return memcmp(store.hash(a), store.hash(b), 32) < 0; };
+    stable_sort(ids.begin(), ids.end(), less);
+    auto same = [&](uint32_t a, uint32_t b) { return memcmp(store.hash(a), store.hash(b), 32) == 0; };
+    ids.erase(unique(ids.begin(), ids.end(), same), ids.end());
+}
+
+bool HashPrefixIndex::prefixBounds(const string& prefix, uint8_t low[32], uint8_t high[32]) {
+    if (prefix.empty() || prefix.size() > 64)
+        return false;
+    string lowHex = prefix + string(64 - prefix.size(), '0');
+    string highHex = prefix + string(64 - prefix.size(), 'f');
+    return hexToHash(lowHex, low) && hexToHash(highHex, high);
+}
+
+bool HashPrefixIndex::find(const string& prefix, size_t limit, vector<size_t>& matches, size_t& total) const {
+    ScopedTimer timer(TIMER_LOOKUP);
+    addStat(COUNT_LOOKUPS);
+    matches.clear();
+    total = 0;
+    uint8_t low[32], high[32];
+    if (!prefixBounds(prefix, low, high))
+        return false;
+
+    auto compare = [&](uint32_t id, const uint8_t* key) {
+        addStat(COUNT_PROBES);
+        return memcmp(store.hash(id), key, 32);
+    };
+    auto first = lower_bound(ids.begin(), ids.end(), low,
+                             [&](uint32_t id, const uint8_t* key) { return compare(id, key) < 0; });
+    auto last = upper_bound(first, ids.end(), high,
+                            [&](const uint8_t* key, uint32_t id) { return compare(id, key) > 0; });
+    total = last - first;
+    for (auto it = first; it != last && matches.size() < limit; ++it)
+        matches.push_back(*it);
+    return true;
+}
+
+string formatHashPrefixMatches(const BlockDb& db, const HashPrefixIndex& index, const string& prefix,
+                               size_t limit, bool& ok) {
+    vector<size_t> matches;
+    size_t total;
+    ok = index.find(prefix, limit, matches, total);
+    if (!ok)
+        return "Invalid hash prefix: " + prefix + " (expected 1-64 lowercase hex digits)\n";
+    if (total == 0)
+        return notFoundMessage("hash prefix", prefix);
+
+    string text;
+    if (total > 1)
+        text = "Ambiguous hash prefix " + prefix + ": " + to_string(total) + " blocks match\n\n";
+    for (size_t i = 0; i < matches.size(); ++i) {
+        appendBlockText(text, db.at(matches[i]));
+        if (total > 1)
+            text += "\n";
+    }
+    if (total > matches.size())
+        text += "... and " + to_string(total - matches.size()) + " more\n";
+    return text;
+}
+
+void printHashPrefixMatches(const BlockDb& db, const HashPrefixIndex& index, const string& prefix, size_t limit) {
+    bool ok;
+    string text = formatHashPrefixMatches(db, index, prefix, limit, ok);
+    if (ok)
+        print_output(text);
+    else
+        print_error(text);
+}
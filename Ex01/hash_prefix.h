@@ -0,0 +1,39 @@
+#pragma once
+#include "blockdb.h"
+
+// Abbreviated-hash lookup, like git's short hashes. Block ids are sorted by
+// their binary hash, so every hash starting with a given prefix sits in one
+// contiguous run found by two binary searches. Duplicate hashes keep only
+// their first block; rows whose hash is not 64 lowercase hex digits are not
+// searchable by prefix.
+class HashPrefixIndex {
+public:
+    explicit HashPrefixIndex(const BlockDb& db);
+    // Only the blocks whose hash starts with prefix, found in one pass: what
+    // a single lookup needs, without sorting every hash
+    HashPrefixIndex(const BlockDb& db, const string& prefix);
+
+    // Blocks whose hash starts with prefix (lowercase hex, 1-64 digits), in
+    // hash order: at most limit ids go to matches, and the total is returned.
+    // Returns false if prefix is not a valid hex prefix.
+    bool find(const string& prefix, size_t limit, vector<size_t>& matches, size_t& total) const;
+
+private:
+    // The smallest and largest hash starting with prefix; false if it is not
+    // a valid prefix
+    static bool prefixBounds(const string& prefix, uint8_t low[32], uint8_t high[32]);
+    void sortIds();
+
+    const BlockStore& store;
+    vector<uint32_t> ids;
+};
+
+const size_t HASH_PREFIX_LIMIT = 10;
+
+// The single match as a block; for several, an "Ambiguous" line followed by
+// up to limit blocks; otherwise the not-found line. Sets ok to false for an
+// invalid prefix (message for stderr in the return value).
+string formatHashPrefixMatches(const BlockDb& db, const HashPrefixIndex& index, const string& prefix,
+                               size_t limit, bool& ok);
+void printHashPrefixMatches(const BlockDb& db, const HashPrefixIndex& index, const string& prefix,
+                            size_t limit = HASH_PREFIX_LIMIT);
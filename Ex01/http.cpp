@@ -0,0 +1,250 @@
+#include "http.h"
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <netdb.h>
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <openssl/x509v3.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+using namespace std;
+
+static const int HTTP_TIMEOUT_SECONDS = 30;
+
+struct Url {
+    bool tls = false;
+    string authority;  // host[:port] as written, for the Host header
+    string host;       // without the brackets of an IPv6 literal
+    string port;
+    string path;
+};
+
+static bool parseUrl(const string& url, Url& out) {
+    size_t rest;
+    if (url.rfind("https://", 0) == 0) {
+        out.tls = true;
+        rest = 8;
+    } else if (url.rfind("http://", 0) == 0) {
+        out.tls = false;
+        rest = 7;
+    } else {
+        return false;
+    }
+
+    size_t slash = url.find('/', rest);
+    string authority = url.substr(rest, slash == string::npos ? string::npos : slash - rest);
+    out.authority = authority;
+    out.path = slash == string::npos ? "/" : url.substr(slash);
+
+    // [v6 address] or host, then an optional :port
+    size_t portColon;
+    if (!authority.empty() && authority[0] == '[') {
+        size_t close = authority.find(']');
+        if (close == string::npos)
+            return false;
+        out.host = authority.substr(1, close - 1);
+        portColon = close + 1 < authority.size() && authority[close + 1] == ':' ? close + 1 : string::npos;
+        if (portColon == string::npos && close + 1 != authority.size())
+            return false;
+    } else {
+        portColon = authority.rfind(':');
+        out.host = authority.substr(0, portColon);
+    }
+    out.port = portColon != string::npos ? authority.substr(portColon + 1) : out.tls ? "443" : "80";
+    return !out.host.empty() && !out.port.empty();
+}
+
+static int connectTo(const Url& url, string& error) {
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* found = nullptr;
+    int rc = getaddrinfo(url.host.c_str(), url.port.c_str(), &hints, &found);
+    if (rc != 0) {
+        error = "cannot resolve " + url.host + ": " + gai_strerror(rc);
+        return -1;
+    }
+
+    int fd = -1;
+    for (addrinfo* a = found; a && fd < 0; a = a->ai_next) {
+        fd = socket(a->ai_family, a->ai_socktype | SOCK_CLOEXEC, a->ai_protocol);
+        if (fd < 0)
+            continue;
+        timeval tv = {HTTP_TIMEOUT_SECONDS, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+        if (connect(fd, a->ai_addr, a->ai_addrlen) != 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(found);
+    if (fd < 0)
+        error = "cannot connect to " + url.host + ":" + url.port;
+    return fd;
+}
+
+// One context for the process; OpenSSL contexts are safe to share between threads
+static SSL_CTX* tlsContext() {
+    static SSL_CTX* ctx = [] {
+        SSL_CTX* c = SSL_CTX_new(TLS_client_method());
+        if (c) {
+            SSL_CTX_set_default_verify_paths(c);
+            SSL_CTX_set_verify(c, SSL_VERIFY_PEER, nullptr);
+        }
+        return c;
+    }();
+    return ctx;
+}
+
+// A plain or TLS connection, read and written the same way
+class Connection {
+public:
+    ~Connection() {
+        if (ssl) {
+            SSL_shutdown(ssl);
+            SSL_free(ssl);
+        }
+        if (fd >= 0)
+            close(fd);
+    }
+
+    bool open(const Url& url, string& error) {
+        fd = connectTo(url, error);
+        if (fd < 0 || !url.tls)
+            return fd >= 0;
+
+        SSL_CTX* ctx = tlsContext();
+        ssl = ctx ? SSL_new(ctx) : nullptr;
+        // An address literal is checked against the certificate's IP entries
+        // and is not sent as the server name
+        bool literal = url.host.find(':') != string::npos || url.host.find_first_not_of("0123456789.") == string::npos;
+        bool named = ssl && (literal ? X509_VERIFY_PARAM_set1_ip_asc(SSL_get0_param(ssl), url.host.c_str())
+                                     : SSL_set_tlsext_host_name(ssl, url.host.c_str()) &&
+                                           SSL_set1_host(ssl, url.host.c_str()));
+        if (!named || !SSL_set_fd(ssl, fd) || SSL_connect(ssl) != 1) {
+            unsigned long code = ERR_get_error();
+            char reason[256] = "handshake failed";
+            if (code)
+                ERR_error_string_n(code, reason, sizeof(reason));
+            error = "TLS with " + url.host + ": " + reason;
+            return false;
+        }
+        return true;
+    }
+
+    bool writeAll(const string& data) {
+        size_t done = 0;
+        while (done < data.size()) {
+            ssize_t n = ssl ? SSL_write(ssl, data.data() + done, (int)(data.size() - done))
+                            : send(fd, data.data() + done, data.size() - done, MSG_NOSIGNAL);
+            if (n <= 0)
+                return false;
+            done += n;
+        }
+        return true;
+    }
+
+    // Reads until the peer closes the connection
+    bool readAll(string& out) {
+        char buf[16384];
+        while (true) {
+            ssize_t n = ssl ? SSL_read(ssl, buf, sizeof(buf)) : recv(fd, buf, sizeof(buf), 0);
+            if (n > 0) {
+                out.append(buf, n);
+                continue;
+            }
+            if (!ssl)
+                return n == 0;
+            int reason = SSL_get_error(ssl, (int)n);
+            // Many servers drop TLS connections without close_notify after the body
+            return reason == SSL_ERROR_ZERO_RETURN || (reason == SSL_ERROR_SYSCALL && ERR_peek_error() == 0);
+        }
+    }
+
+private:
+    int fd = -1;
+    SSL* ssl = nullptr;
+};
+
+static bool decodeChunked(const string& raw, size_t pos, string& body) {
+    body.clear();
+    while (true) {
+        size_t eol = raw.find("\r\n", pos);
+        if (eol == string::npos)
+            return false;
+        size_t length = strtoul(raw.c_str() + pos, nullptr, 16);
+        pos = eol + 2;
+        if (length == 0)
+            return true;
+        if (pos + length > raw.size())
+            return false;
+        body.append(raw, pos, length);
+        pos += length + 2;  // chunk data is followed by CRLF
+    }
+}
+
+bool httpGet(const string& url, int& status, string& body, string& error, HttpHeaders* headers) {
+    Url parsed;
+    if (!parseUrl(url, parsed)) {
+        error = "unsupported URL: " + url;
+        return false;
+    }
+
+    Connection conn;
+    if (!conn.open(parsed, error))
+        return false;
+
+    string request = "GET " + parsed.path + " HTTP/1.1\r\n"
+                     "Host: " + parsed.authority + "\r\n"
+                     "User-Agent: blocks-fetcher\r\n"
+                     "Accept: application/json\r\n"
+                     "Connection: close\r\n\r\n";
+    string raw;
+    if (!conn.writeAll(request) || !conn.readAll(raw)) {
+        error = "connection to " + parsed.host + " failed";
+        return false;
+    }
+
+    size_t headerEnd = raw.find("\r\n\r\n");
+    if (raw.rfind("HTTP/1.", 0) != 0 || headerEnd == string::npos) {
+        error = "malformed response from " + parsed.host;
+        return false;
+    }
+    status = atoi(raw.c_str() + raw.find(' ') + 1);
+
+    // Header names are case-insensitive; only chunked encoding changes the body
+    bool chunked = false;
+    if (headers)
+        headers->clear();
+    size_t line = raw.find("\r\n") + 2;
+    while (line < headerEnd) {
+        size_t next = raw.find("\r\n", line);
+        if (strncasecmp(raw.c_str() + line, "transfer-encoding:", 18) == 0 &&
+            raw.substr(line, next - line).find("chunked") != string::npos)
+            chunked = true;
+        size_t colon = raw.find(':', line);
+        if (headers && colon < next) {
+            string name = raw.substr(line, colon - line);
+            for (char& c : name)
+                c = tolower((unsigned char)c);
+            size_t value = raw.find_first_not_of(" \t", colon + 1);
+            headers->emplace_back(name, value < next ? raw.substr(value, next - value) : "");
+        }
+        line = next + 2;
+    }
+
+    if (chunked) {
+        if (!decodeChunked(raw, headerEnd + 4, body)) {
+            error = "truncated response from " + parsed.host;
+            return false;
+        }
+    } else {
+        body = raw.substr(headerEnd + 4);
+    }
+    return true;
+}
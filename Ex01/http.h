@@ -0,0 +1,16 @@
+#pragma once
+#include <string>
+#include <utility>
+#include <vector>
+
+// Response headers as (lower-case name, value) pairs, in the order received
+typedef std::vector<std::pair<std::string, std::string>> HttpHeaders;
+
+// Minimal blocking HTTP/1.1 GET for http:// and https:// URLs (OpenSSL,
+// peer and host name verified). IPv6 hosts are written in brackets, as in
+// http://[::1]:8080/. One connection per request.
+// Returns false on network/protocol errors with a reason in error;
+// otherwise status holds the HTTP status code and body the decoded body,
+// and headers, if given, the response headers.
+bool httpGet(const std::string& url, int& status, std::string& body, std::string& error,
+             HttpHeaders* headers = nullptr);
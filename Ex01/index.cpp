@@ -0,0 +1,280 @@
+#include "index.h"
+#include "stats.h"
+#include "snapshot.h"
+#include <cstring>
+#include <cstdio>
+#include <unistd.h>
+
+static const char INDEX_MAGIC[8] = {'B', 'L', 'K', 'I', 'D', 'X', '\0', '\0'};
+
+uint64_t hashSlot(const uint8_t hash[32], uint64_t slotCount) {
+    // Block hashes start with zero bytes (proof of work), so key on the tail
+    uint64_t key;
+    memcpy(&key, hash + 24, sizeof(key));
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    return key & (slotCount - 1);
+}
+
+// Whether both tables of h lie inside a file of size bytes, checked without
+// overflowing. Probing masks with slotCount - 1 and stops at an empty slot,
+// so the table must be a non-empty power of two that is never full.
+static bool validLayout(const IndexHeader& h, uint64_t size) {
+    if (h.slotCount == 0 || (h.slotCount & (h.slotCount - 1)) != 0 || h.count >= h.slotCount)
+        return false;
+    if (h.slotsOff % alignof(IndexSlot) != 0 || h.slotsOff > size ||
+        h.slotCount > (size - h.slotsOff) / sizeof(IndexSlot))
+        return false;
+    return h.heightsOff % alignof(uint64_t) == 0 && h.heightsOff <= size &&
+           h.heightCount <= (size - h.heightsOff) / sizeof(uint64_t);
+}
+
+// Writes the index beside indexPath and renames it into place, so a reader
+// maps either the old index or the complete new one
+static bool writeIndexFile(const string& indexPath, IndexHeader& h, const vector<IndexSlot>& slots,
+                           const vector<uint64_t>& heights) {
+    h.slotsOff = sizeof(h);
+    h.heightsOff = h.slotsOff + h.slotCount * sizeof(IndexSlot);
+
+    string tmp = indexPath + ".tmp." + to_string(getpid());
+    FILE* f = fopen(tmp.c_str(), "wb");
+    if (!f)
+        return false;
+    bool ok = fwrite(&h, sizeof(h), 1, f) == 1;
+    ok = ok && fwrite(slots.data(), sizeof(IndexSlot), slots.size(), f) == slots.size();
+    ok = ok && fwrite(heights.data(), sizeof(uint64_t), heights.size(), f) == heights.size();
+    ok = (fclose(f) == 0) && ok;
+    if (!ok || rename(tmp.c_str(), indexPath.c_str()) != 0) {
+        remove(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool buildIndex(const string& indexPath, const MappedFile& blocks) {
+    ScopedTimer timer(TIMER_INDEX_BUILD);
+    struct Entry {
+        uint8_t hash[32];
+        bool validHash;
+        long long height;
+        uint64_t offset;
+    };
+
+    vector<Entry> entries;
+    long long minHeight = 0, maxHeight = -1;
+    bool allHashes = true;
+
+    const char* begin = blocks.data();
+    const char* end = begin + blocks.size();
+    const char* p = begin;
+    Block block;
+    while (p && p < end) {
+        const char* start = p;
+        p = parseBlockRecord(p, end, block);
+        if (!p)
+            break;
+
+        Entry e;
+        e.validHash = hexToHash(block.hash, e.hash);
+        allHashes = allHashes && e.validHash;
+        e.height = block.height;
+        e.offset = start - begin;
+        entries.push_back(e);
+        addStat(COUNT_BLOCKS_PARSED);
+
+        if (maxHeight < minHeight) {
+            minHeight = maxHeight = e.height;
+        } else {
+            minHeight = min(minHeight, e.height);
+            maxHeight = max(maxHeight, e.height);
+        }
+    }
+
+    IndexHeader h = {};
+    memcpy(h.magic, INDEX_MAGIC, sizeof(h.magic));
+    h.version = INDEX_VERSION;
+    h.sourceSize = blocks.info().st_size;
+    h.sourceMtimeNs = mtimeNs(blocks.info());
+    h.sourceGeneration = blocksGeneration();
+    h.count = entries.size();
+    h.slotCount = 16;
+    while (h.slotCount < entries.size() * 2)  // load factor <= 0.5
+        h.slotCount <<= 1;
+    h.flags = allHashes ? INDEX_ALL_HASHES : 0;
+    h.minHeight = minHeight;
+
+    // Dense only while the heights are; a sparse or corrupt range is left to scans
+    uint64_t span = entries.empty() ? 0 : (uint64_t)(maxHeight - minHeight + 1);
+    if (span <= 4 * entries.size() + 1024) {
+        h.heightCount = span;
+        h.flags |= INDEX_HEIGHTS;
+    }
+    vector<IndexSlot> slots(h.slotCount);
+    vector<uint64_t> heights(h.heightCount);
+    memset(slots.data(), 0, slots.size() * sizeof(IndexSlot));
+
+    // First record wins for duplicate keys, same as a front-to-back scan
+    for (const Entry& e : entries) {
+        if (e.validHash) {
+            uint64_t i = hashSlot(e.hash, h.slotCount);
+            while (slots[i].offset != 0 && memcmp(slots[i].hash, e.hash, 32) != 0)
+                i = (i + 1) & (h.slotCount - 1);
+            if (slots[i].offset == 0) {
+                memcpy(slots[i].hash, e.hash, 32);
+                slots[i].offset = e.offset + 1;
+            }
+        }
+        if (h.heightCount == 0)
+            continue;
+        uint64_t& cell = heights[e.height - minHeight];
+        if (cell == 0)
+            cell = e.offset + 1;
+    }
+
+    return writeIndexFile(indexPath, h, slots, heights);
+}
+
+bool BlockIndex::open(const string& indexPath, const string& blocksPath) {
+    if (!blocks.open(blocksPath))
+        return false;
+
+    if (index.open(indexPath) && attach())
+        return true;
+
+    // Missing or built from different data
+    if (!buildIndex(indexPath, blocks) || !index.open(indexPath))
+        return false;
+    return attach();
+}
+
+bool BlockIndex::attach() {
+    if (index.size() < sizeof(IndexHeader))
+        return false;
+    memcpy(&header, index.data(), sizeof(header));
+
+    if (memcmp(header.magic, INDEX_MAGIC, sizeof(header.magic)) != 0 || header.version != INDEX_VERSION)
+        return false;
+    if (header.sourceSize != (uint64_t)blocks.info().st_size || header.sourceMtimeNs != mtimeNs(blocks.info()) ||
+        header.sourceGeneration != blocksGeneration())
+        return false;
+    if (!validLayout(header, index.size()))
+        return false;
+
+    slots = reinterpret_cast<const IndexSlot*>(index.data() + header.slotsOff);
+    heights = reinterpret_cast<const uint64_t*>(index.data() + header.heightsOff);
+    return true;
+}
+
+bool BlockIndex::readRecord(uint64_t stored, Block& out) const {
+    if (stored == 0 || stored > blocks.size())
+        return false;
+    const char* end = blocks.data() + blocks.size();
+    return parseBlockRecord(blocks.data() + stored - 1, end, out) != nullptr;
+}
+
+bool BlockIndex::findByHash(const uint8_t hash[32], Block& out) const {
+    if (!slots)
+        return false;
+
+    addStat(COUNT_LOOKUPS);
+    uint64_t i = hashSlot(hash, header.slotCount);
+    while (slots[i].offset != 0) {
+        addStat(COUNT_PROBES);
+        if (memcmp(slots[i].hash, hash, 32) == 0)
+            return readRecord(slots[i].offset, out);
+        i = (i + 1) & (header.slotCount - 1);
+    }
+    return false;
+}
+
+bool BlockIndex::findByHeight(long long height, Block& out) const {
+    if (!heights || height < header.minHeight || (uint64_t)(height - header.minHeight) >= header.heightCount)
+        return false;
+    addStat(COUNT_LOOKUPS);
+    addStat(COUNT_PROBES);
+    return readRecord(heights[height - header.minHeight], out);
+}
+
+bool BlockIndex::newestHeight(long long& height) const {
+    if (!heights || !coversHeights() || header.heightCount == 0)
+        return false;
+    height = header.minHeight + (long long)header.heightCount - 1;
+    return true;
+}
+
+bool prependIndex(const string& indexPath, const struct stat& oldSource, const vector<PrependedRecord>& added,
+                  uint64_t shift, const struct stat& newSource, unsigned long long newGeneration) {
+    MappedFile old;
+    if (!old.open(indexPath) || old.size() < sizeof(IndexHeader))
+        return false;
+    IndexHeader h;
+    memcpy(&h, old.data(), sizeof(h));
+    if (memcmp(h.magic, INDEX_MAGIC, sizeof(h.magic)) != 0 || h.version != INDEX_VERSION ||
+        h.sourceSize != (uint64_t)oldSource.st_size || h.sourceMtimeNs != mtimeNs(oldSource) ||
+        h.sourceGeneration != blocksGeneration() || !validLayout(h, old.size()) || !(h.flags & INDEX_HEIGHTS))
+        return false;
+
+    // The height array grows to cover the new blocks, as long as it stays dense
+    long long minHeight = h.minHeight, maxHeight = h.minHeight + (long long)h.heightCount - 1;
+    for (const PrependedRecord& r : added) {
+        bool first = maxHeight < minHeight;
+        minHeight = first ? r.block.height : min<long long>(minHeight, r.block.height);
+        maxHeight = first ? r.block.height : max<long long>(maxHeight, r.block.height);
+    }
+    uint64_t heightCount = maxHeight < minHeight ? 0 : (uint64_t)(maxHeight - minHeight + 1);
+    if (heightCount > 4 * (h.count + added.size()) + 1024)
+        return false;
+
+    const IndexSlot* oldSlots = reinterpret_cast<const IndexSlot*>(old.data() + h.slotsOff);
+    const uint64_t* oldHeights = reinterpret_cast<const uint64_t*>(old.data() + h.heightsOff);
+
+    // The slots hold the hashes, so a table that would pass half full is
+    // grown by rehashing them rather than by reading the text again
+    uint64_t slotCount = h.slotCount;
+    while (slotCount < (h.count + added.size()) * 2)
+        slotCount <<= 1;
+    vector<IndexSlot> slots(slotCount);
+    memset(slots.data(), 0, slotCount * sizeof(IndexSlot));
+    for (uint64_t s = 0; s < h.slotCount; ++s) {
+        if (oldSlots[s].offset == 0)
+            continue;
+        uint64_t i = s;
+        if (slotCount != h.slotCount) {
+            i = hashSlot(oldSlots[s].hash, slotCount);
+            while (slots[i].offset != 0)
+                i = (i + 1) & (slotCount - 1);
+        }
+        slots[i] = oldSlots[s];
+        slots[i].offset += shift;
+    }
+    h.slotCount = slotCount;
+    vector<uint64_t> heights(heightCount);
+    for (uint64_t i = 0; i < h.heightCount; ++i)
+        if (oldHeights[i] != 0)
+            heights[h.minHeight - minHeight + i] = oldHeights[i] + shift;
+
+    // The first record in the file wins, so entering the new ones last to
+    // first and overwriting leaves each key with its earliest record
+    for (auto r = added.rbegin(); r != added.rend(); ++r) {
+        uint8_t hash[32];
+        if (hexToHash(r->block.hash, hash)) {
+            uint64_t i = hashSlot(hash, h.slotCount);
+            while (slots[i].offset != 0 && memcmp(slots[i].hash, hash, 32) != 0)
+                i = (i + 1) & (h.slotCount - 1);
+            memcpy(slots[i].hash, hash, 32);
+            slots[i].offset = r->offset + 1;
+        } else {
+            h.flags &= ~INDEX_ALL_HASHES;
+        }
+        heights[r->block.height - minHeight] = r->offset + 1;
+    }
+
+    h.count += added.size();
+    h.minHeight = minHeight;
+    h.heightCount = heightCount;
+    h.sourceSize = newSource.st_size;
+    h.sourceMtimeNs = mtimeNs(newSource);
+    h.sourceGeneration = newGeneration;
+    return writeIndexFile(indexPath, h, slots, heights);
+}
@@ -0,0 +1,89 @@
+#pragma once
+#include "utils.h"
+#include "mapped_file.h"
+
+// Persistent lookup index for blocks.txt, stored next to it as blocks.idx.
+//
+// Layout (little endian):
+//   IndexHeader
+//   IndexSlot slots[slotCount]      open addressing on the binary block hash
+//   uint64_t  heights[heightCount]  dense, heights[h - minHeight]
+//
+// Both tables hold (byte offset of the record in blocks.txt) + 1, 0 meaning
+// empty, so a lookup is one probe plus one record parse from the mapped text.
+// The header carries the size and mtime of the indexed blocks.txt and the
+// blocks.gen generation; a stale index is rebuilt on open.
+
+const string INDEX_FILE = "blocks.idx";
+const uint32_t INDEX_VERSION = 2;
+
+// IndexHeader::flags
+const uint32_t INDEX_ALL_HASHES = 1;  // every record's hash is in the table
+const uint32_t INDEX_HEIGHTS = 2;     // the height array covers every record
+
+struct IndexHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+    uint64_t sourceSize;
+    int64_t sourceMtimeNs;
+    uint64_t sourceGeneration;
+    uint64_t count;
+    uint64_t slotCount;
+    int64_t minHeight;
+    uint64_t heightCount;
+    uint64_t slotsOff;
+    uint64_t heightsOff;
+};
+
+struct IndexSlot {
+    uint8_t hash[32];
+    uint64_t offset;
+};
+
+class BlockIndex {
+public:
+    // Maps blocksPath and its index, rebuilding the index if it is missing or stale.
+    bool open(const string& indexPath = INDEX_FILE, const string& blocksPath = BLOCKS_FILE);
+
+    // A miss is only authoritative when the matching flag is set
+    bool coversHashes() const { return header.flags & INDEX_ALL_HASHES; }
+    bool coversHeights() const { return header.flags & INDEX_HEIGHTS; }
+
+    bool findByHash(const uint8_t hash[32], Block& out) const;
+    bool findByHeight(long long height, Block& out) const;
+
+    // Highest stored height; needs coversHeights() and at least one record
+    bool newestHeight(long long& height) const;
+
+private:
+    bool attach();
+    bool readRecord(uint64_t stored, Block& out) const;
+
+    MappedFile blocks;
+    MappedFile index;
+    IndexHeader header {};
+    const IndexSlot* slots = nullptr;
+    const uint64_t* heights = nullptr;
+};
+
+// Scans the mapped text and writes a fresh index for it.
+bool buildIndex(const string& indexPath, const MappedFile& blocks);
+
+// A record written at the front of blocks.txt, for prependIndex
+struct PrependedRecord {
+    uint64_t offset;  // in the new file
+    Block block;
+};
+
+// Carries an index that matched oldSource over to newSource (and
+// newGeneration), the same records moved down by shift bytes behind added:
+// the old tables are copied with their offsets shifted and added entered on
+// top, then published by rename like a rebuild, with the hash table grown as
+// needed. Returns false if the index was stale or has to be rebuilt (heights
+// no longer dense).
+bool prependIndex(const string& indexPath, const struct stat& oldSource, const vector<PrependedRecord>& added,
+                  uint64_t shift, const struct stat& newSource, unsigned long long newGeneration);
+
+// Slot for a 32-byte hash in a table of slotCount (a power of two) entries
+uint64_t hashSlot(const uint8_t hash[32], uint64_t slotCount);
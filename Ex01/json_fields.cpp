@@ -0,0 +1,88 @@
+#include "json_fields.h"
+
+using namespace std;
+
+static bool isSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+// Index just past the closing quote of the string opening at json[i]
+static size_t skipString(string_view json, size_t i) {
+    for (++i; i < json.size(); ++i) {
+        if (json[i] == '\\')
+            ++i;
+        else if (json[i] == '"')
+            return i + 1;
+    }
+    return json.size();
+}
+
+bool jsonField(string_view json, string_view key, string_view& value) {
+    int depth = 0;
+    size_t i = 0;
+
+    while (i < json.size()) {
+        char c = json[i];
+        if (c == '{' || c == '[') {
+            ++depth;
+            ++i;
+        } else if (c == '}' || c == ']') {
+            --depth;
+            ++i;
+        } else if (c != '"') {
+            ++i;
+        } else {
+            size_t start = i + 1;
+            i = skipString(json, i);
+            if (depth != 1)
+                continue;
+
+            // Only a string followed by ':' is a key
+            size_t colon = i;
+            while (colon < json.size() && isSpace(json[colon]))
+                ++colon;
+            if (colon >= json.size() || json[colon] != ':')
+                continue;
+            if (json.substr(start, i - 1 - start) != key) {
+                i = colon + 1;
+                continue;
+            }
+
+            size_t v = colon + 1;
+            while (v < json.size() && isSpace(json[v]))
+                ++v;
+            if (v >= json.size())
+                return false;
+            if (json[v] == '"') {
+                size_t close = skipString(json, v);
+                value = json.substr(v + 1, close - v - 2);
+            } else {
+                size_t e = v;
+                while (e < json.size() && json[e] != ',' && json[e] != '}' && !isSpace(json[e]))
+                    ++e;
+                value = json.substr(v, e - v);
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+void appendJsonString(string& out, string_view field) {
+    static const char digits[] = "0123456789abcdef";
+    out += '"';
+    for (char c : field) {
+        unsigned char u = c;
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (u < 0x20) {
+            out += "\\u00";
+            out += digits[u >> 4];
+            out += digits[u & 0xf];
+        } else {
+            out += c;
+        }
+    }
+    out += '"';
+}
@@ -0,0 +1,13 @@
+#pragma once
+#include <string>
+#include <string_view>
+
+// Finds a top-level member of a JSON object without building a document.
+// value is the raw text of the member: the characters between the quotes for
+// a string (escapes are left as they are), the literal for anything else.
+// Nested objects and arrays are skipped, so "hash" inside "txs" never matches.
+bool jsonField(std::string_view json, std::string_view key, std::string_view& value);
+
+// Appends field as a quoted JSON string, escaping quotes, backslashes and
+// control characters
+void appendJsonString(std::string& out, std::string_view field);
@@ -0,0 +1,47 @@
+#include "mapped_file.h"
+#include "stats.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+bool MappedFile::open(const std::string& path) {
+    ScopedTimer timer(TIMER_OPEN);
+    close();
+
+    fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    if (fstat(fd, &st) != 0) {
+        close();
+        return false;
+    }
+
+    length = static_cast<size_t>(st.st_size);
+    if (length == 0)
+        return true;  // nothing to map, but the file exists
+
+    void* p = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED) {
+        close();
+        return false;
+    }
+    base = static_cast<const char*>(p);
+    addStat(COUNT_BYTES_READ, length);
+    return true;
+}
+
+void MappedFile::close() {
+    if (base)
+        munmap(const_cast<char*>(base), length);
+    if (fd >= 0)
+        ::close(fd);
+    fd = -1;
+    base = nullptr;
+    length = 0;
+    st = {};
+}
@@ -0,0 +1,27 @@
+#pragma once
+#include <string>
+#include <sys/stat.h>
+
+// Read-only memory mapping of a whole file.
+class MappedFile {
+public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool open(const std::string& path);
+    void close();
+
+    bool isOpen() const { return fd >= 0; }
+    const char* data() const { return base; }
+    size_t size() const { return length; }
+    const struct stat& info() const { return st; }
+
+private:
+    int fd = -1;
+    const char* base = nullptr;
+    size_t length = 0;
+    struct stat st {};
+};
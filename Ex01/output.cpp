@@ -0,0 +1,88 @@
+#include "output.h"
+#include "stats.h"
+#include <charconv>
+#include <csignal>
+#include <cstring>
+
+OutputBuffer::OutputBuffer(int fd, size_t capacity) : fd(fd), buffer(capacity) {
+    cout.flush();
+    fflush(stdout);
+}
+
+OutputBuffer::~OutputBuffer() {
+    flush();
+}
+
+bool OutputBuffer::flush() {
+    size_t done = 0;
+    while (!failed && done < used) {
+        ssize_t n = write(fd, buffer.data() + done, used - done);
+        if (n <= 0)
+            failed = true;
+        else
+            done += n;
+    }
+    addStat(COUNT_BYTES_WRITTEN, done);
+    used = 0;
+    return !failed;
+}
+
+void OutputBuffer::append(string_view text) {
+    if (used + text.size() > buffer.size())
+        flush();
+    if (text.size() > buffer.size()) {
+        // Larger than the buffer: no point copying it
+        size_t done = 0;
+        while (!failed && done < text.size()) {
+            ssize_t n = write(fd, text.data() + done, text.size() - done);
+            if (n <= 0)
+                failed = true;
+            else
+                done += n;
+        }
+        return;
+    }
+    memcpy(buffer.data() + used, text.data(), text.size());
+    used += text.size();
+}
+
+void OutputBuffer::append(long long value) {
+    char digits[24];
+    char* end = to_chars(digits, digits + sizeof(digits), value).ptr;
+    append(string_view(digits, end - digits));
+}
+
+void OutputBuffer::appendBlock(const Block& block) {
+    append("hash: ");
+    append(block.hash);
+    append("\nheight: ");
+    append((long long)block.height);
+    append("\ntotal: ");
+    append(block.total);
+    append("\ntime: ");
+    append(block.time);
+    append("\nrelayed_by: ");
+    append(block.relayed_by);
+    append("\nprevious_block: ");
+    append(block.previous_block);
+    append("\n");
+}
+
+Pager::Pager() {
+    if (!isatty(STDOUT_FILENO))
+        return;
+
+    const char* pager = getenv("PAGER");
+    cout.flush();
+    fflush(stdout);
+    pipe = popen(pager && *pager ? pager : "less", "w");
+    if (pipe)
+        oldSigpipe = signal(SIGPIPE, SIG_IGN);  // quitting the pager early must not kill us
+}
+
+Pager::~Pager() {
+    if (!pipe)
+        return;
+    pclose(pipe);
+    signal(SIGPIPE, oldSigpipe);
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include "utils.h"
+#include <csignal>
+#include <cstdio>
+#include <unistd.h>
+
+// Formats straight into one reusable buffer and hands it to the kernel in
+// large writes, instead of a flush per line. Anything already queued in
+// cout/stdout is flushed first so output stays in order.
+class OutputBuffer {
+public:
+    explicit OutputBuffer(int fd = STDOUT_FILENO, size_t capacity = 1 << 20);
+    ~OutputBuffer();
+
+    OutputBuffer(const OutputBuffer&) = delete;
+    OutputBuffer& operator=(const OutputBuffer&) = delete;
+
+    void append(string_view text);
+    void append(long long value);
+    // Same bytes as printBlock()
+    void appendBlock(const Block& block);
+
+    // False once a write failed (e.g. the pager was closed)
+    bool flush();
+    bool ok() const { return !failed; }
+
+private:
+    int fd;
+    vector<char> buffer;
+    size_t used = 0;
+    bool failed = false;
+};
+
+// Sends output through $PAGER (default "less") while stdout is a terminal;
+// otherwise writes to stdout as usual.
+class Pager {
+public:
+    Pager();
+    ~Pager();
+
+    int fd() const { return pipe ? fileno(pipe) : STDOUT_FILENO; }
+
+private:
+    FILE* pipe = nullptr;
+    void (*oldSigpipe)(int) = SIG_DFL;  // restored once the pager is closed
+};
@@ -0,0 +1,318 @@
+#include "paged_store.h"
+#include "block_store.h"
+#include "snapshot.h"
+#include "stats.h"
+#include "output.h"
+#include <memory>
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+
+static const char PAGE_INDEX_MAGIC[8] = {'B', 'L', 'K', 'P', 'A', 'G', 'E', 'S'};
+static const size_t DEFAULT_CACHE_MB = 64;
+// About 1% false positives at 10 bits and 7 probes per block
+static const size_t BLOOM_BITS_PER_BLOCK = 10;
+static const uint32_t BLOOM_HASHES = 7;
+
+size_t pageCacheBytes() {
+    const char* env = getenv("BLOCKS_CACHE_MB");
+    long long mb = env ? atoll(env) : 0;
+    return (mb > 0 ? (size_t)mb : DEFAULT_CACHE_MB) << 20;
+}
+
+// Spreads a hash key over all 64 bits (splitmix64's finalizer); the key is
+// raw hash bytes, which need not be uniform enough to probe a filter with
+static uint64_t mixKey(uint64_t key) {
+    key ^= key >> 30;
+    key *= 0xbf58476d1ce4e5b9ULL;
+    key ^= key >> 27;
+    key *= 0x94d049bb133111ebULL;
+    return key ^ (key >> 31);
+}
+
+// Bit positions h1 + i * h2 (double hashing) for i in [0, hashes)
+template <typename Fn>
+static void bloomProbes(uint64_t key, size_t bits, uint32_t hashes, Fn fn) {
+    uint64_t mixed = mixKey(key);
+    uint64_t h1 = mixed & 0xffffffff, h2 = (mixed >> 32) | 1;
+    for (uint32_t i = 0; i < hashes; ++i)
+        fn((h1 + i * h2) % bits);
+}
+
+static size_t blockBytes(const Block& b) {
+    return sizeof(Block) + b.hash.capacity() + b.time.capacity() + b.relayed_by.capacity() +
+           b.previous_block.capacity();
+}
+
+// Unlinked temporary files beside the page index, one per key range, that
+// hold the hash keys until they are sorted a range at a time
+class KeyBuckets {
+public:
+    // Enough buckets that one holds about memory bytes of count keys spread
+    // evenly (the keys are the random end of a block hash); none if all fit
+    KeyBuckets(const string& path, size_t count, size_t memory) {
+        while (bits < MAX_BITS && count * sizeof(HashEntry) >> bits > memory)
+            ++bits;
+        for (size_t b = 0; b < ((size_t)1 << bits) && bits; ++b) {
+            string name = path + ".tmp." + to_string(getpid()) + "." + to_string(b);
+            FILE* f = fopen(name.c_str(), "w+b");
+            ok = ok && f;
+            if (f) {
+                remove(name.c_str());  // gone once closed, however this ends
+                files.push_back(f);
+            }
+        }
+    }
+    ~KeyBuckets() {
+        for (FILE* f : files)
+            fclose(f);
+    }
+
+    void add(const HashEntry& e) {
+        if (!bits)
+            inMemory.push_back(e);
+        else
+            ok = ok && fwrite(&e, sizeof(e), 1, files[e.key >> (64 - bits)]) == 1;
+    }
+
+    // Every key in order, one bucket in memory at a time. Equal keys keep
+    // frame order, so the first frame holding a hash is found first.
+    bool writeSorted(FILE* out) {
+        for (size_t b = 0; b < ((size_t)1 << bits) && ok; ++b) {
+            if (bits) {
+                long bytes = ftell(files[b]);
+                inMemory.resize(bytes > 0 ? bytes / sizeof(HashEntry) : 0);
+                ok = fseek(files[b], 0, SEEK_SET) == 0 &&
+                     fread(inMemory.data(), sizeof(HashEntry), inMemory.size(), files[b]) == inMemory.size();
+            }
+            sort(inMemory.begin(), inMemory.end(), [](const HashEntry& a, const HashEntry& b) {
+                return a.key != b.key ? a.key < b.key : a.frame < b.frame;
+            });
+            ok = ok && fwrite(inMemory.data(), sizeof(HashEntry), inMemory.size(), out) == inMemory.size();
+            vector<HashEntry>().swap(inMemory);
+        }
+        return ok;
+    }
+
+private:
+    static const unsigned MAX_BITS = 8;  // at most 256 files open
+    unsigned bits = 0;
+    bool ok = true;
+    vector<FILE*> files;
+    vector<HashEntry> inMemory;  // all keys with no buckets, else the one being sorted
+};
+
+bool writePageIndex(const string& packPath) {
+    ScopedTimer timer(TIMER_INDEX_BUILD);
+    BlockPack pack;
+    if (!pack.open(packPath))
+        return false;
+
+    // Keys go out through buckets capped at the page cache size, so the
+    // sort stays within the memory the store is allowed
+    string path = packPath + PAGE_INDEX_SUFFIX;
+    size_t frames = pack.frameCount();
+    vector<FrameRange> ranges(frames);
+    KeyBuckets keys(path, pack.size(), pageCacheBytes());
+    size_t bloomWords = max<size_t>(1, (pack.size() * BLOOM_BITS_PER_BLOCK + 63) / 64);
+    vector<uint64_t> bloom(bloomWords, 0);
+
+    // One frame at a time, handing each frame's pages back once read
+    vector<Block> blocks;
+    for (size_t f = 0; f < frames; ++f) {
+        blocks.clear();
+        if (!pack.decodeFrame(f, blocks) || blocks.empty())
+            return false;
+        ranges[f] = {blocks[0].height, blocks[0].height};
+        for (const Block& b : blocks) {
+            ranges[f].minHeight = min(ranges[f].minHeight, b.height);
+            ranges[f].maxHeight = max(ranges[f].maxHeight, b.height);
+            uint64_t key = BlockStore::hashKey(b.hash);
+            keys.add({key, f});
+            bloomProbes(key, 64 * bloomWords, BLOOM_HASHES,
+                        [&](uint64_t bit) { bloom[bit / 64] |= 1ULL << (bit % 64); });
+        }
+        pack.release(f);
+    }
+
+    struct stat st;
+    if (stat(packPath.c_str(), &st) != 0)
+        return false;
+    PageIndexHeader h{};
+    memcpy(h.magic, PAGE_INDEX_MAGIC, sizeof(h.magic));
+    h.version = PAGE_INDEX_VERSION;
+    h.bloomHashes = BLOOM_HASHES;
+    h.count = pack.size();
+    h.frameCount = frames;
+    h.packSize = (uint64_t)st.st_size;
+    h.packMtimeNs = mtimeNs(st);
+    h.bloomWords = bloomWords;
+    h.rangesOff = sizeof(h);
+    h.bloomOff = h.rangesOff + (frames * sizeof(FrameRange) + 7) / 8 * 8;
+    h.keysOff = h.bloomOff + bloomWords * sizeof(uint64_t);
+
+    // Write next to the target and rename so readers never map a half-written file
+    string tmp = path + ".tmp." + to_string(getpid());
+    FILE* f = fopen(tmp.c_str(), "wb");
+    if (!f)
+        return false;
+    static const char padding[8] = {};
+    bool ok = fwrite(&h, sizeof(h), 1, f) == 1;
+    ok = ok && fwrite(ranges.data(), sizeof(FrameRange), frames, f) == frames;
+    ok = ok && fwrite(padding, 1, h.bloomOff - h.rangesOff - frames * sizeof(FrameRange), f) ==
+                   h.bloomOff - h.rangesOff - frames * sizeof(FrameRange);
+    ok = ok && fwrite(bloom.data(), sizeof(uint64_t), bloomWords, f) == bloomWords;
+    ok = ok && keys.writeSorted(f);
+    ok = (fclose(f) == 0) && ok;
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+        remove(tmp.c_str());
+        return false;
+    }
+    addStat(COUNT_BYTES_WRITTEN, h.keysOff + pack.size() * sizeof(HashEntry));
+    return true;
+}
+
+bool PagedBlockStore::loadIndex(const string& path) {
+    if (!indexFile.open(path) || indexFile.size() < sizeof(PageIndexHeader))
+        return false;
+    PageIndexHeader h;
+    memcpy(&h, indexFile.data(), sizeof(h));
+    const struct stat& st = pack.mappedStat();
+    if (memcmp(h.magic, PAGE_INDEX_MAGIC, sizeof(h.magic)) != 0 || h.version != PAGE_INDEX_VERSION ||
+        h.count != pack.size() || h.frameCount != pack.frameCount() || h.packSize != (uint64_t)st.st_size ||
+        h.packMtimeNs != mtimeNs(st) || h.bloomHashes == 0 || h.bloomWords == 0)
+        return false;
+    if (h.rangesOff + h.frameCount * sizeof(FrameRange) > h.bloomOff ||
+        h.bloomOff + h.bloomWords * sizeof(uint64_t) > h.keysOff ||
+        h.keysOff + h.count * sizeof(HashEntry) > indexFile.size())
+        return false;
+
+    const char* base = indexFile.data();
+    ranges.assign((const FrameRange*)(base + h.rangesOff), (const FrameRange*)(base + h.rangesOff) + h.frameCount);
+    bloom.assign((const uint64_t*)(base + h.bloomOff), (const uint64_t*)(base + h.bloomOff) + h.bloomWords);
+    bloomHashes = h.bloomHashes;
+    keys = (const HashEntry*)(base + h.keysOff);
+    return true;
+}
+
+bool PagedBlockStore::open(const string& packPath) {
+    cached.clear();
+    recent.clear();
+    used = 0;
+    keys = nullptr;
+    packStale = false;
+    if (!pack.open(packPath))
+        return false;
+    if (pack.stale()) {
+        packStale = true;
+        return false;
+    }
+    string path = packPath + PAGE_INDEX_SUFFIX;
+    if (loadIndex(path))
+        return true;
+    return writePageIndex(packPath) && loadIndex(path);
+}
+
+const vector<Block>* PagedBlockStore::frame(size_t f) {
+    auto it = cached.find(f);
+    if (it != cached.end()) {
+        addStat(COUNT_CACHE_HITS);
+        recent.splice(recent.begin(), recent, it->second.use);
+        return &it->second.blocks;
+    }
+
+    addStat(COUNT_CACHE_MISSES);
+    CachedFrame entry;
+    if (!pack.decodeFrame(f, entry.blocks))
+        return nullptr;
+    entry.bytes = 0;
+    for (const Block& b : entry.blocks)
+        entry.bytes += blockBytes(b);
+    recent.push_front(f);
+    entry.use = recent.begin();
+    used += entry.bytes;
+    CachedFrame& stored = cached.emplace(f, move(entry)).first->second;
+
+    // Least recently used frames out until under the cap; the new one stays
+    while (used > capacity && recent.size() > 1) {
+        size_t victim = recent.back();
+        recent.pop_back();
+        auto old = cached.find(victim);
+        used -= old->second.bytes;
+        cached.erase(old);
+        pack.release(victim);
+    }
+    return &stored.blocks;
+}
+
+bool PagedBlockStore::mayContain(uint64_t key) const {
+    bool all = true;
+    bloomProbes(key, 64 * bloom.size(), bloomHashes,
+                [&](uint64_t bit) { all = all && (bloom[bit / 64] >> (bit % 64) & 1); });
+    return all;
+}
+
+bool PagedBlockStore::findByHash(const string& hash, Block& out) {
+    ScopedTimer timer(TIMER_LOOKUP);
+    addStat(COUNT_LOOKUPS);
+    uint64_t key = BlockStore::hashKey(hash);
+    if (!mayContain(key)) {
+        addStat(COUNT_BLOOM_REJECTS);
+        return false;
+    }
+
+    const HashEntry* end = keys + size();
+    const HashEntry* it =
+        lower_bound(keys, end, key, [](const HashEntry& e, uint64_t k) { return e.key < k; });
+    for (; it != end && it->key == key; ++it) {
+        addStat(COUNT_PROBES);
+        const vector<Block>* blocks = frame(it->frame);
+        if (!blocks)
+            return false;
+        for (const Block& b : *blocks)
+            if (b.hash == hash) {
+                out = b;
+                return true;
+            }
+    }
+    return false;
+}
+
+bool PagedBlockStore::findByHeight(long long height, Block& out) {
+    ScopedTimer timer(TIMER_LOOKUP);
+    addStat(COUNT_LOOKUPS);
+    for (size_t f = 0; f < ranges.size(); ++f) {
+        if (height < ranges[f].minHeight || height > ranges[f].maxHeight)
+            continue;
+        addStat(COUNT_PROBES);
+        const vector<Block>* blocks = frame(f);
+        if (!blocks)
+            return false;
+        for (const Block& b : *blocks)
+            if (b.height == height) {
+                out = b;
+                return true;
+            }
+    }
+    return false;
+}
+
+bool printBlocks(PagedBlockStore& store, bool paged) {
+    ScopedTimer timer(TIMER_PRINT);
+    unique_ptr<Pager> pager(paged ? new Pager() : nullptr);
+    OutputBuffer out(pager ? pager->fd() : STDOUT_FILENO);
+
+    size_t printed = 0;
+    for (size_t f = 0; f < store.frameCount() && out.ok(); ++f) {
+        const vector<Block>* blocks = store.frame(f);
+        if (!blocks)
+            return false;
+        for (const Block& b : *blocks) {
+            out.appendBlock(b);
+            if (++printed != store.size())
+                out.append("|\n|\n|\nV\n");
+        }
+    }
+    out.flush();
+    return true;
+}
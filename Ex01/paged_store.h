@@ -0,0 +1,138 @@
+#pragma once
+#include "block_pack.h"
+#include <algorithm>
+#include <list>
+#include <unordered_map>
+
+// Out-of-core access to a block pack. The pack's frames are the pages: a
+// lookup decodes only the frames it needs, through an LRU cache of decoded
+// frames whose size is capped, so memory stays bounded however large the
+// pack grows. Evicted frames also give their mapped pages back.
+//
+// What lookups need to find a frame lives in a sidecar, <pack>.pages, built
+// from the pack the first time it is opened and rebuilt when the pack
+// changes (its size and mtime are recorded, as blocks.snap does):
+//   PageIndexHeader
+//   FrameRange ranges[frameCount]   lowest and highest height in each frame
+//   uint64_t   bloom[bloomWords]    Bloom filter over the block hashes
+//   HashEntry  keys[count]          BlockStore::hashKey -> frame, sorted
+// The ranges and the Bloom filter are read into memory (a few bytes per
+// block); the key table stays mapped and is binary searched, so a hash that
+// is not in the pack is usually rejected without touching the disk. Building
+// the key table sorts through temporary files once it outgrows the page
+// cache cap, so that stays the memory bound.
+
+const uint32_t PAGE_INDEX_VERSION = 1;
+const string PAGE_INDEX_SUFFIX = ".pages";
+
+struct PageIndexHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t bloomHashes;
+    uint64_t count;
+    uint64_t frameCount;
+    uint64_t packSize;
+    int64_t packMtimeNs;
+    uint64_t bloomWords;
+    uint64_t rangesOff;
+    uint64_t bloomOff;
+    uint64_t keysOff;
+};
+
+struct FrameRange {
+    int32_t minHeight;
+    int32_t maxHeight;
+};
+
+struct HashEntry {
+    uint64_t key;
+    uint64_t frame;
+};
+
+// Page cache cap: BLOCKS_CACHE_MB megabytes if set, otherwise 64 MB
+size_t pageCacheBytes();
+
+// Writes <packPath>.pages for the pack at packPath
+bool writePageIndex(const string& packPath);
+
+class PagedBlockStore {
+public:
+    explicit PagedBlockStore(size_t cacheBytes = pageCacheBytes()) : capacity(cacheBytes) {}
+
+    // Opens the pack and its page index, (re)building the index if it is
+    // missing or stale. False if either can't be read or written, or if the
+    // pack was made from a blocks.txt that has changed since (see stale()).
+    bool open(const string& packPath = PACK_FILE);
+    // The last open() failed because the pack is behind blocks.txt
+    bool stale() const { return packStale; }
+
+    size_t size() const { return pack.size(); }
+    size_t frameCount() const { return pack.frameCount(); }
+
+    // Decoded blocks of frame f; valid until the next call. Null if corrupt.
+    const vector<Block>* frame(size_t f);
+
+    // The first block (in pack order) with that hash or height
+    bool findByHash(const string& hash, Block& out);
+    bool findByHeight(long long height, Block& out);
+    // Blocks with a height in [lo, hi], in height order (ties in pack order)
+    template <typename Fn>
+    bool forEachInHeightRange(long long lo, long long hi, Fn fn);
+
+    size_t cachedBytes() const { return used; }
+
+private:
+    bool mayContain(uint64_t key) const;
+    bool loadIndex(const string& path);
+
+    struct CachedFrame {
+        vector<Block> blocks;
+        size_t bytes;
+        list<size_t>::iterator use;
+    };
+
+    BlockPack pack;
+    bool packStale = false;
+    MappedFile indexFile;
+    vector<FrameRange> ranges;
+    vector<uint64_t> bloom;
+    uint32_t bloomHashes = 0;
+    const HashEntry* keys = nullptr;
+
+    size_t capacity;
+    size_t used = 0;
+    list<size_t> recent;  // cached frames, most recently used first
+    unordered_map<size_t, CachedFrame> cached;
+};
+
+// Every block in pack order, one frame in memory at a time; paged as printBlocks
+bool printBlocks(PagedBlockStore& store, bool paged = false);
+
+template <typename Fn>
+bool PagedBlockStore::forEachInHeightRange(long long lo, long long hi, Fn fn) {
+    // Positions first, so memory grows with the matches and not the frames
+    struct Match {
+        int height;
+        size_t frame;
+        size_t row;
+    };
+    vector<Match> matches;
+    for (size_t f = 0; f < ranges.size(); ++f) {
+        if (ranges[f].maxHeight < lo || ranges[f].minHeight > hi)
+            continue;
+        const vector<Block>* blocks = frame(f);
+        if (!blocks)
+            return false;
+        for (size_t r = 0; r < blocks->size(); ++r)
+            if ((*blocks)[r].height >= lo && (*blocks)[r].height <= hi)
+                matches.push_back({(*blocks)[r].height, f, r});
+    }
+    stable_sort(matches.begin(), matches.end(), [](const Match& a, const Match& b) { return a.height < b.height; });
+    for (const Match& m : matches) {
+        const vector<Block>* blocks = frame(m.frame);
+        if (!blocks)
+            return false;
+        fn((*blocks)[m.row]);
+    }
+    return true;
+}
@@ -1,27 +1,55 @@
 #include "printer.h"
+#include "stats.h"
 
 using namespace std;
 
+// One write and one flush per block rather than one per line
 void printBlock(const Block& block) {
-    std::cout << "hash: " << block.hash << std::endl;
-    std::cout << "height: " << block.height << std::endl;
-    std::cout << "total: " << block.total << std::endl;
-    std::cout << "time: " << block.time << std::endl;
-    std::cout << "relayed_by: " << block.relayed_by << std::endl;
-    std::cout << "previous_block: " << block.previous_block << std::endl;
+    ScopedTimer timer(TIMER_PRINT);
+    string text;
+    appendBlockText(text, block);
+    std::cout << text << std::flush;
+    addStat(COUNT_BYTES_WRITTEN, text.size());
+}
+
+void appendBlockText(string& out, const Block& block) {
+    out += "hash: " + block.hash + "\n";
+    out += "height: " + to_string(block.height) + "\n";
+    out += "total: " + to_string(block.total) + "\n";
+    out += "time: " + block.time + "\n";
+    out += "relayed_by: " + block.relayed_by + "\n";
+    out += "previous_block: " + block.previous_block + "\n";
 }
 
 void print_output(const std::string& message) {
     std::cout << message;
 }
 
+// The innermost ErrorCapture on this thread, if any
+static thread_local std::string* errorCapture = nullptr;
+
 void print_error(const std::string& message) {
-    std::cerr << message;
+    if (errorCapture)
+        errorCapture->append(message);
+    else
+        std::cerr << message;
+}
+
+ErrorCapture::ErrorCapture() : outer(errorCapture) {
+    errorCapture = &captured;
 }
 
+ErrorCapture::~ErrorCapture() {
+    errorCapture = outer;
+}
+
+
+string notFoundMessage(const std::string& field, const std::string& value) {
+    return "No matching block found for " + field + ": " + value + "\n";
+}
 
 void printNotFoundMessage(const std::string& field, const std::string& value) {
-    std::cout << "No matching block found for " << field << ": " << value << std::endl;
+    std::cout << notFoundMessage(field, value) << std::flush;
 }
 
 void PrintMenu()
@@ -30,7 +58,11 @@ void PrintMenu()
     cout << "1. Print db" << endl;
     cout << "2. Print block by hash" << endl;
     cout << "3. Print block by height" << endl;
-    cout << "4. Export data to csv" << endl;
-    cout << "5. Refresh data" << endl;
+    cout << "4. Export data (csv, jsonl or bin)" << endl;
+    cout << "5. Refresh data (in the background)" << endl;
+    cout << "6. Aggregate totals over a height range" << endl;
+    cout << "7. Print blocks by hash prefix" << endl;
+    cout << "8. Group blocks by relay, hour or day" << endl;
+    cout << "9. Print blocks matching a filter" << endl;
     cout << "Enter your choice: ";
 }
\ No newline at end of file
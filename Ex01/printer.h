@@ -2,9 +2,30 @@
 #include "utils.h"
 
 void printBlock(const Block& block);
+// The same six lines printBlock writes, appended to out
+void appendBlockText(string& out, const Block& block);
 
 void print_error(const std::string& message);
 void print_output(const std::string& message);
+
+// While one is alive, print_error calls made on the thread that created it
+// are collected here instead of reaching stderr, so a background worker's
+// errors can be shown when it reports back rather than over the menu prompt
+class ErrorCapture {
+public:
+    ErrorCapture();
+    ~ErrorCapture();
+    ErrorCapture(const ErrorCapture&) = delete;
+    ErrorCapture& operator=(const ErrorCapture&) = delete;
+
+    const std::string& text() const { return captured; }
+
+private:
+    std::string captured;
+    std::string* outer;  // the capture this one replaced on its thread
+};
+// The line printNotFoundMessage prints
+string notFoundMessage(const std::string& field, const std::string& value);
 void printNotFoundMessage(const std::string& field, const std::string& value);
 void PrintMenu();
 
@@ -1,15 +1,56 @@
 #include "utils.h"
 #include "printer.h"
+#include "daemon.h"
+#include "stats.h"
+#include "paged_store.h"
 #include <iostream>
 #include <fstream>
 #include <string>
 
 using namespace std;
 
-int main() {
+int main(int argc, char* argv[]) {
+
+    parseStatsFlag("q1", argc, argv);
+
+    // BLOCKS_DAEMON_SOCKET set: let a running blockd.out answer if it can
+    int status;
+    if (runThroughDaemon("q1", argc, argv, status))
+        return status;
+
+    // --page: page the dump when writing to a terminal
+    // --pack: read blocks.pack a frame at a time instead of loading blocks.txt
+    bool paged = false, packed = false;
+    for (int i = 1; i < argc; ++i) {
+        string flag = argv[i];
+        if (flag == "--page" && !paged) {
+            paged = true;
+        } else if (flag == "--pack" && !packed) {
+            packed = true;
+        } else {
+            print_error("Usage: " + string(argv[0]) + " [--page] [--pack]\n");
+            return 1;
+        }
+    }
+
+    if (packed) {
+        PagedBlockStore store;
+        if (!store.open()) {
+            if (store.stale())
+                print_error(PACK_FILE + " is older than " + BLOCKS_FILE + " (rebuild it with blockpack.out pack)\n");
+            else
+                print_error("Failed to open file: " + PACK_FILE + " (create it with blockpack.out pack)\n");
+            return 1;
+        }
+        if (!printBlocks(store, paged)) {
+            print_error("Not a valid pack file: " + PACK_FILE + "\n");
+            return 1;
+        }
+        return 0;
+    }
 
     vector<Block> blocks = load_db();
-    printBlocks(blocks);
+    printBlocks(blocks, paged);
     return 0;
 }
 
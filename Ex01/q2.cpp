@@ -1,30 +1,381 @@
 #include "utils.h"
 #include "printer.h"
+#include "daemon.h"
+#include "blockdb.h"
+#include "chain.h"
+#include "range.h"
+#include "aggregate.h"
+#include "hash_prefix.h"
+#include "group_by.h"
+#include "filter.h"
+#include "paged_store.h"
+#include "output.h"
+#include "block_view.h"
+#include "stats.h"
+#include <unordered_map>
 #include <iostream>
 #include <fstream>
 
 using namespace std;
 
+int RunChainQuery(const string& option, const string& first, const string& second);
+int RunRangeQuery(const string& option, const string& range);
+int RunAggregate(const string& range);
+int RunBatch(const string& source);
+int RunHashPrefix(const string& prefix, const string& limitText);
+int RunGroupBy(const string& fieldName, const string& topText);
+int RunWhere(const string& expression);
+int RunPacked(const string& option, const string& value);
+
+void PrintUsage(const string& program) {
+    print_error("Usage: " + program + " --hash <value> OR --height <value>\n"
+                "       " + program + " --ancestor <hash> <k>\n"
+                "       " + program + " --path <hash> <hash>\n"
+                "       " + program + " --common-ancestor <hash> <hash>\n"
+                "       " + program + " --height-range <from>:<to>\n"
+                "       " + program + " --time-range <from>:<to>   (epoch seconds, YYYY-MM-DD or YYYY-MM-DDTHH:MM:SSZ)\n"
+                "       " + program + " --aggregate <from>:<to>    (sum/avg/min/max of totals over heights)\n"
+                "       " + program + " --batch [file|-]           (one hash or height per line, default stdin)\n"
+                "       " + program + " --hash-prefix <prefix> [limit]   (abbreviated hash, up to limit matches)\n"
+                "       " + program + " --group-by <relay|hour|day> [top]   (blocks and volume per group)\n"
+                "       " + program + " --where <filter>           (e.g. \"total > 1e12 AND height BETWEEN 850000 AND 850100\")\n"
+                "       " + program + " --pack --hash <value> | --height <value> | --height-range <from>:<to>\n"
+                "                  (from blocks.pack through a page cache of BLOCKS_CACHE_MB, default 64)\n");
+}
+
 
 int main(int argc, char* argv[]) {
 
-    if (argc != 3) {
-        print_error("Usage: " + string(argv[0]) + " --hash <value> OR --height <value>\n");
+    parseStatsFlag("q2", argc, argv);
+
+    // BLOCKS_DAEMON_SOCKET set: let a running blockd.out answer if it can
+    int status;
+    if (runThroughDaemon("q2", argc, argv, status))
+        return status;
+
+    if (argc < 2) {
+        PrintUsage(argv[0]);
         return 1;
     }
 
     string option = argv[1];
+
+    if (option == "--ancestor" || option == "--path" || option == "--common-ancestor") {
+        if (argc != 4) {
+            PrintUsage(argv[0]);
+            return 1;
+        }
+        return RunChainQuery(option, argv[2], argv[3]);
+    }
+
+    if (option == "--pack") {
+        if (argc != 4) {
+            PrintUsage(argv[0]);
+            return 1;
+        }
+        return RunPacked(argv[2], argv[3]);
+    }
+
+    if (option == "--hash-prefix" && (argc == 3 || argc == 4))
+        return RunHashPrefix(argv[2], argc == 4 ? argv[3] : "");
+
+    if (option == "--group-by" && (argc == 3 || argc == 4))
+        return RunGroupBy(argv[2], argc == 4 ? argv[3] : "");
+
+    if (option == "--batch" && argc <= 3)
+        return RunBatch(argc == 3 ? argv[2] : "-");
+
+    if (argc != 3) {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
     string value = argv[2];
-    vector<Block> blocks = load_db();
+    string field;
+
+    if (option == "--height-range" || option == "--time-range")
+        return RunRangeQuery(option, value);
+    if (option == "--aggregate")
+        return RunAggregate(value);
+    if (option == "--where")
+        return RunWhere(value);
 
     if (option == "--hash") {
-        findAndPrintBlockByField("hash", value, blocks);
+        field = "hash";
     } else if (option == "--height") {
-        findAndPrintBlockByField("height", value, blocks);
+        field = "height";
     } else {
-        print_output("Invalid option: " + option + "\nUse --hash or --height\n");
+        print_output("Invalid option: " + option + "\nUse --hash, --height, --ancestor, --path, --common-ancestor, --height-range, --time-range, --aggregate, --batch, --hash-prefix, --group-by or --where\n");
+        return 1;
+    }
+
+    // Single probe through blocks.idx; full load only if the index can't answer
+    if (!findAndPrintBlockIndexed(field, value)) {
+        vector<Block> blocks = load_db();
+        findAndPrintBlockByField(field, value, blocks);
+    }
+
+    return 0;
+}
+
+// Ancestor / path / common-ancestor queries over the previous_block chain.
+// One query walks the links it needs; building a ChainIndex would cost more.
+int RunChainQuery(const string& option, const string& first, const string& second) {
+    BlockDb db;
+    if (!db.refresh())
+        return 1;
+
+    bool ok;
+    string text = formatChainQuery(db, ChainWalk(db), option, first, second, ok);
+    if (!ok) {
+        print_error(text);
+        return 1;
+    }
+    print_output(text);
+    return 0;
+}
+
+// Prints every block whose height or time falls in an inclusive range, in key order
+int RunRangeQuery(const string& option, const string& range) {
+    long long lo, hi;
+    bool byHeight = option == "--height-range";
+    if (!(byHeight ? parseHeightRange(range, lo, hi) : parseTimeRange(range, lo, hi))) {
+        print_error("Invalid range: " + range + "\n");
+        return 1;
+    }
+
+    BlockDb db;
+    if (!db.refresh())
+        return 1;
+
+    // One query: a scan beats sorting every block into a RangeIndex first
+    SortedColumn found = byHeight ? heightsInRange(db, lo, hi) : timesInRange(db, lo, hi);
+    if (found.ids.empty())
+        print_output("No blocks found for " + option.substr(2) + ": " + range + "\n");
+
+    OutputBuffer out;
+    for (size_t i = 0; i < found.ids.size() && out.ok(); ++i) {
+        out.appendBlock(db.at(found.ids[i]));
+        out.append("\n");
+    }
+    return 0;
+}
+
+// Sum, average, min and max of block totals over an inclusive height range
+int RunAggregate(const string& range) {
+    long long lo, hi;
+    if (!parseHeightRange(range, lo, hi)) {
+        print_error("Invalid range: " + range + "\n");
+        return 1;
+    }
+
+    BlockDb db;
+    if (!db.refresh())
+        return 1;
+
+    printTotalsSummary(summarizeTotals(db, lo, hi));
+    return 0;
+}
+
+// Blocks whose hash starts with prefix; several matches are reported as ambiguous
+int RunHashPrefix(const string& prefix, const string& limitText) {
+    long long limit = HASH_PREFIX_LIMIT;
+    if (!limitText.empty() && (!parseHeight(limitText, limit) || limit < 1)) {
+        print_error("Invalid match limit: " + limitText + "\n");
         return 1;
     }
 
+    BlockDb db;
+    if (!db.refresh())
+        return 1;
+
+    // Just the matching blocks: sorting every hash would only pay off over many lookups
+    HashPrefixIndex index(db, prefix);
+    bool ok;
+    string text = formatHashPrefixMatches(db, index, prefix, limit, ok);
+    if (!ok) {
+        print_error(text);
+        return 1;
+    }
+    print_output(text);
+    return 0;
+}
+
+// Block count and volume per relay, hour or day; with top, only the largest groups
+int RunGroupBy(const string& fieldName, const string& topText) {
+    GroupField field;
+    if (!parseGroupField(fieldName, field)) {
+        print_error("Unknown group field: " + fieldName + " (use relay, hour or day)\n");
+        return 1;
+    }
+    long long top = 0;
+    if (!topText.empty() && (!parseHeight(topText, top) || top < 1)) {
+        print_error("Invalid group count: " + topText + "\n");
+        return 1;
+    }
+
+    BlockDb db;
+    if (!db.refresh())
+        return 1;
+
+    size_t groupCount;
+    vector<Group> groups = groupBlocks(db.store(), field, top, groupCount);
+    printGroups(groups, field, groupCount);
+    return 0;
+}
+
+// Prints the blocks a filter expression (see filter.h) selects, in DB order
+int RunWhere(const string& expression) {
+    Filter filter;
+    string error;
+    if (!filter.compile(expression, error)) {
+        print_error(error);
+        return 1;
+    }
+
+    BlockDb db;
+    if (!db.refresh())
+        return 1;
+
+    Selection rows = filter.select(db.store());
+    if (rows.count() == 0)
+        print_output("No blocks match: " + expression + "\n");
+
+    OutputBuffer out;
+    for (size_t i : rows.indexes()) {
+        if (!out.ok())
+            break;
+        out.appendBlock(db.at(i));
+        out.append("\n");
+    }
+    return 0;
+}
+
+// Hash, height and height-range lookups answered from blocks.pack without
+// loading it: only the frames holding an answer are decoded (paged_store.h)
+int RunPacked(const string& option, const string& value) {
+    long long lo = 0, hi = 0;
+    if (option == "--height-range" && !parseHeightRange(value, lo, hi)) {
+        print_error("Invalid range: " + value + "\n");
+        return 1;
+    }
+    if (option != "--hash" && option != "--height" && option != "--height-range") {
+        print_output("Invalid option: " + option + "\nUse --hash, --height or --height-range with --pack\n");
+        return 1;
+    }
+
+    PagedBlockStore store;
+    if (!store.open()) {
+        if (store.stale())
+            print_error(PACK_FILE + " is older than " + BLOCKS_FILE + " (rebuild it with blockpack.out pack)\n");
+        else
+            print_error("Failed to open file: " + PACK_FILE + " (create it with blockpack.out pack)\n");
+        return 1;
+    }
+
+    if (option == "--height-range") {
+        OutputBuffer out;
+        size_t found = 0;
+        bool ok = store.forEachInHeightRange(lo, hi, [&](const Block& b) {
+            ++found;
+            out.appendBlock(b);
+            out.append("\n");
+        });
+        if (!ok) {
+            out.flush();
+            print_error("Not a valid pack file: " + PACK_FILE + "\n");
+            return 1;
+        }
+        if (found == 0)
+            out.append("No blocks found for height-range: " + value + "\n");
+        return 0;
+    }
+
+    Block block;
+    long long height;
+    bool found = option == "--hash" ? store.findByHash(value, block)
+                                    : parseHeight(value, height) && store.findByHeight(height, block);
+    if (found)
+        printBlock(block);
+    else
+        printNotFoundMessage(option.substr(2), value);
+    return 0;
+}
+
+// Answers many lookups with one load: the keys are hashed up front, the
+// blocks are scanned once, and results come out in input order, each
+// followed by a blank line. A line that is a valid height is a height key,
+// anything else a hash.
+int RunBatch(const string& source) {
+    ifstream file;
+    if (source != "-") {
+        file.open(source);
+        if (!file) {
+            print_error("Failed to open file: " + source + "\n");
+            return 1;
+        }
+    }
+    istream& in = source == "-" ? cin : file;
+
+    struct Key {
+        bool byHeight;
+        long long height;
+        string value;
+        size_t match = SIZE_MAX;  // row in the text, first one wins
+    };
+    vector<Key> keys;
+    string line;
+    while (getline(in, line)) {
+        size_t end = line.find_last_not_of(" \t\r");
+        size_t start = line.find_first_not_of(" \t");
+        if (end == string::npos)
+            continue;
+        Key key;
+        key.value = line.substr(start, end - start + 1);
+        key.byHeight = parseHeight(key.value, key.height);
+        keys.push_back(move(key));
+    }
+
+    // Distinct keys -> their slot in keys (the first occurrence answers the rest)
+    unordered_map<string_view, size_t> hashes;
+    unordered_map<long long, size_t> heights;
+    vector<size_t> answeredBy(keys.size());
+    for (size_t i = 0; i < keys.size(); ++i) {
+        if (keys[i].byHeight)
+            answeredBy[i] = heights.emplace(keys[i].height, i).first->second;
+        else
+            answeredBy[i] = hashes.emplace(keys[i].value, i).first->second;
+    }
+
+    BlockTextFile text;
+    if (!text.open()) {
+        print_error("Failed to open file: " + BLOCKS_FILE + "\n");
+        return 1;
+    }
+    ScopedTimer timer(TIMER_LOOKUP);
+    addStat(COUNT_LOOKUPS, keys.size());
+    const vector<BlockView>& views = text.blocks();
+    for (size_t row = 0; row < views.size(); ++row) {
+        if (!hashes.empty()) {
+            auto it = hashes.find(views[row].hash);
+            if (it != hashes.end() && keys[it->second].match == SIZE_MAX)
+                keys[it->second].match = row;
+        }
+        if (!heights.empty()) {
+            auto it = heights.find(views[row].height);
+            if (it != heights.end() && keys[it->second].match == SIZE_MAX)
+                keys[it->second].match = row;
+        }
+    }
+
+    OutputBuffer out;
+    for (size_t i = 0; i < keys.size() && out.ok(); ++i) {
+        const Key& key = keys[answeredBy[i]];
+        if (key.match == SIZE_MAX)
+            out.append(notFoundMessage(key.byHeight ? "height" : "hash", keys[i].value));
+        else
+            out.appendBlock(views[key.match].toBlock());
+        out.append("\n");
+    }
     return 0;
 }
@@ -1,12 +1,55 @@
 #include "utils.h"
+#include "printer.h"
+#include "daemon.h"
+#include "export.h"
+#include "blockdb.h"
+#include "filter.h"
+#include "stats.h"
 #include <fstream>
 #include <iostream>
 #include <string>
 #include <vector>
 
 
-int main() {
+int main(int argc, char* argv[]) {
+
+    parseStatsFlag("q3", argc, argv);
+
+    // BLOCKS_DAEMON_SOCKET set: let a running blockd.out answer if it can
+    int status;
+    if (runThroughDaemon("q3", argc, argv, status))
+        return status;
     
-    ExportTxtToCSV();
-    return 0;
-}
\ No newline at end of file
+    ExportFormat format = ExportFormat::Csv;
+    string where;
+    bool filtered = false;
+    for (int i = 1; i < argc; i += 2) {
+        string option = argv[i];
+        if (i + 1 == argc || (option != "--format" && option != "--where")) {
+            print_error("Usage: " + string(argv[0]) + " [--format csv|jsonl|bin] [--where <filter>]\n");
+            return 1;
+        }
+        if (option == "--where") {
+            where = argv[i + 1];
+            filtered = true;
+        } else if (!parseExportFormat(argv[i + 1], format)) {
+            print_error("Unknown format: " + string(argv[i + 1]) + "\nUse csv, jsonl or bin\n");
+            return 1;
+        }
+    }
+
+    if (!filtered)
+        return exportBlocks(format) ? 0 : 1;
+
+    // Only the blocks the filter selects, in DB order
+    Filter filter;
+    string error;
+    if (!filter.compile(where, error)) {
+        print_error(error);
+        return 1;
+    }
+    BlockDb db;
+    if (!db.refresh())
+        return 1;
+    return exportSelection(format, db, filter.select(db.store())) ? 0 : 1;
+}
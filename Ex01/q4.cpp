@@ -2,16 +2,23 @@
 #include <cstdlib> // for system()
 #include <string>
 #include "printer.h"
+#include "refresh.h"
+#include "stats.h"
 
 using namespace std;
 
 
 int main(int argc, char* argv[]) {
+  parseStatsFlag("q4", argc, argv);
   if (argc != 2) {
-      print_error("Usage: " + string(argv[0]) + " <number_of_blocks>\n");
+      print_error("Usage: " + string(argv[0]) + " <number_of_blocks> | --incremental\n");
       return 1;
   }
 
+  // Only fetch what is newer than the stored blocks and add it in front
+  if (string(argv[1]) == "--incremental")
+      return refreshDataIncremental() ? 0 : 1;
+
   int numBlocks = stoi(argv[1]); // Convert input string to int
   refreshData(numBlocks);
 
@@ -1,5 +1,14 @@
 #include "printer.h"
 #include "utils.h"
+#include "blockdb.h"
+#include "export.h"
+#include "refresh.h"
+#include "resident_indexes.h"
+#include "hash_prefix.h"
+#include "group_by.h"
+#include "filter.h"
+#include "output.h"
+#include "stats.h"
 #include <fstream>
 #include <iostream>
 #include <string>
@@ -7,56 +16,149 @@
 
 using namespace std;
 
-void RunQ5();
-void ExecuteChoice(int choiceNum, vector<Block> blocks);
+void RunQ5(BlockDb& db, unique_ptr<ResidentIndexes>& indexes, BackgroundRefresh& refresher);
+void ExecuteChoice(int choiceNum, const BlockDb& db, ResidentIndexes& indexes, BackgroundRefresh& refresher);
 
-int main() {
-    
+int main(int argc, char* argv[]) {
+    parseStatsFlag("q5", argc, argv);
+
+    // Loaded once; each iteration only picks up what changed in blocks.txt,
+    // and the indexes built over it are kept until it does
+    BlockDb db;
+    unique_ptr<ResidentIndexes> indexes;
+    BackgroundRefresh refresher;
     while(true){
-        RunQ5();
+        RunQ5(db, indexes, refresher);
     }
 
     return 0;
 }
 
-void RunQ5() {
+void RunQ5(BlockDb& db, unique_ptr<ResidentIndexes>& indexes, BackgroundRefresh& refresher) {
 
-    vector<Block> blocks = load_db();
+    string status = refresher.status();
+    if (!status.empty())
+        print_output(status + "\n");
     PrintMenu();
     int choice;
     cin >> choice;
-    ExecuteChoice(choice, blocks);
+    db.refresh();  // after the wait for input, so the choice sees current data
+    if (!indexes || indexes->generation() != db.generation())
+        indexes.reset(new ResidentIndexes(db));
+    ExecuteChoice(choice, db, *indexes, refresher);
+
+    // The menu never exits, so --stats reports each choice on its own
+    if (statsEnabled()) {
+        printStats();
+        resetStats();
+    }
 }
 
-void ExecuteChoice (int choiceNum, vector<Block> blocks)
+void ExecuteChoice (int choiceNum, const BlockDb& db, ResidentIndexes& indexes, BackgroundRefresh& refresher)
 {
     if (choiceNum == 1)
     {
-        printBlocks(blocks);
+        printBlocks(db);
     }
     else if (choiceNum == 2)
     {
         string hashNumber;
         print_output("Enter block hash: \n");
         cin >> hashNumber;
-        findAndPrintBlockByField("hash", hashNumber, blocks);
+        findAndPrintBlockByField("hash", hashNumber, db);
     }
     else if (choiceNum == 3)
     {
         string heightNumber;
         print_output("Enter block height: \n");
         cin >> heightNumber;
-        findAndPrintBlockByField("height", heightNumber, blocks);
+        findAndPrintBlockByField("height", heightNumber, db);
     }
     else if (choiceNum == 4)
     {
-        ExportTxtToCSV();
+        string formatName;
+        ExportFormat format;
+        print_output("Enter export format (csv/jsonl/bin): \n");
+        cin >> formatName;
+        if (parseExportFormat(formatName, format))
+            exportBlocks(format);
+        else
+            print_error("Unknown format: " + formatName + "\n");
     }
     else if (choiceNum == 5) 
     {
     int numOfNewBlocks;
-    print_output("Enter number of blocks to fetch: ");
+    print_output("Enter number of blocks to fetch (0 = only blocks newer than the stored ones): ");
     cin >> numOfNewBlocks;
-    refreshData(numOfNewBlocks);
+    // Runs on its own thread; the menu keeps answering from what is stored so far
+    if (numOfNewBlocks < 0)
+        print_error("Invalid number of blocks: " + to_string(numOfNewBlocks) + "\n");
+    else if (refresher.start(numOfNewBlocks))
+        print_output("Refresh started in the background\n");
+    else
+        print_output("A refresh is already running\n");
+    }
+    else if (choiceNum == 6)
+    {
+        string range;
+        long long lo, hi;
+        print_output("Enter height range (from:to): \n");
+        cin >> range;
+        if (parseHeightRange(range, lo, hi))
+        {
+            printTotalsSummary(indexes.totals().summarize(lo, hi));
+        }
+        else
+        {
+            print_error("Invalid range: " + range + "\n");
+        }
+    }
+    else if (choiceNum == 7)
+    {
+        string prefix;
+        print_output("Enter hash prefix: \n");
+        cin >> prefix;
+        printHashPrefixMatches(db, indexes.prefixes(), prefix);
+    }
+    else if (choiceNum == 8)
+    {
+        string fieldName;
+        GroupField field;
+        long long top;
+        print_output("Group by (relay/hour/day): \n");
+        cin >> fieldName;
+        print_output("Enter number of groups to show (0 = all): \n");
+        cin >> top;
+        if (!parseGroupField(fieldName, field))
+            print_error("Unknown group field: " + fieldName + "\n");
+        else if (top < 0)
+            print_error("Invalid group count: " + to_string(top) + "\n");
+        else
+        {
+            size_t groupCount;
+            vector<Group> groups = groupBlocks(db.store(), field, top, groupCount);
+            printGroups(groups, field, groupCount);
+        }
+    }
+    else if (choiceNum == 9)
+    {
+        string expression, error;
+        Filter filter;
+        print_output("Enter filter (e.g. total > 1e12 AND relayed_by = 1.2.3.4:8333): \n");
+        getline(cin >> ws, expression);
+        if (!filter.compile(expression, error))
+        {
+            print_error(error);
+            return;
+        }
+        Selection rows = filter.select(db.store());
+        if (rows.count() == 0)
+            print_output("No blocks match: " + expression + "\n");
+        OutputBuffer out;
+        for (size_t i : rows.indexes())
+        {
+            out.appendBlock(db.at(i));
+            out.append("\n");
+        }
     }
 }
\ No newline at end of file
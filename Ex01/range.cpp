@@ -0,0 +1,99 @@
+#include "range.h"
+#include "stats.h"
+#include <algorithm>
+#include <climits>
+#include <numeric>
+
+pair<size_t, size_t> SortedColumn::range(long long lo, long long hi) const {
+    ScopedTimer timer(TIMER_LOOKUP);
+    addStat(COUNT_LOOKUPS);
+    if (lo > hi)
+        return {0, 0};
+    size_t first = lower_bound(keys.begin(), keys.end(), lo) - keys.begin();
+    size_t last = upper_bound(keys.begin() + first, keys.end(), hi) - keys.begin();
+    return {first, last};
+}
+
+// Sorts the ids in order (ascending ids) by key, ties keeping DB order
+template <typename KeyFn>
+static SortedColumn buildColumn(vector<uint32_t> order, KeyFn key) {
+    stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return key(a) < key(b); });
+
+    SortedColumn column;
+    column.keys.reserve(order.size());
+    for (uint32_t id : order)
+        column.keys.push_back(key(id));
+    column.ids = move(order);
+    return column;
+}
+
+RangeIndex::RangeIndex(const BlockDb& db) {
+    ScopedTimer timer(TIMER_INDEX_BUILD);
+    vector<uint32_t> all(db.size());
+    iota(all.begin(), all.end(), 0);
+    byHeight = buildColumn(all, [&](size_t i) { return (long long)db.height(i); });
+    byTime = buildColumn(move(all), [&](size_t i) { return db.epoch(i); });
+}
+
+template <typename T>
+static SortedColumn columnInRange(const T* keys, size_t n, long long lo, long long hi) {
+    ScopedTimer timer(TIMER_LOOKUP);
+    addStat(COUNT_LOOKUPS);
+    addStat(COUNT_PROBES, n);
+    vector<uint32_t> matches;
+    for (size_t i = 0; i < n; ++i)
+        if (keys[i] >= lo && keys[i] <= hi)
+            matches.push_back((uint32_t)i);
+    return buildColumn(move(matches), [&](size_t i) { return (long long)keys[i]; });
+}
+
+SortedColumn heightsInRange(const BlockDb& db, long long lo, long long hi) {
+    return columnInRange(db.store().heightColumn(), db.size(), lo, hi);
+}
+
+SortedColumn timesInRange(const BlockDb& db, long long lo, long long hi) {
+    return columnInRange(db.store().epochColumn(), db.size(), lo, hi);
+}
+
+static bool parseNumber(const string& text, long long& value) {
+    if (text.empty() || text.find_first_not_of("-0123456789") != string::npos)
+        return false;
+    try {
+        size_t used;
+        value = stoll(text, &used);
+        return used == text.size();
+    } catch (const exception&) {
+        return false;
+    }
+}
+
+bool parseTimeValue(const string& text, long long& value) {
+    if (parseNumber(text, value))
+        return true;
+    if (text.size() == 10)
+        return parseTime(text + "T00:00:00Z", value);
+    return text.size() >= 19 && parseTime(text, value);
+}
+
+bool parseHeightRange(const string& text, long long& lo, long long& hi) {
+    size_t colon = text.find(':');
+    if (colon == string::npos || text.find(':', colon + 1) != string::npos)
+        return false;
+    string left = text.substr(0, colon), right = text.substr(colon + 1);
+    lo = LLONG_MIN;
+    hi = LLONG_MAX;
+    return (left.empty() || parseNumber(left, lo)) && (right.empty() || parseNumber(right, hi));
+}
+
+bool parseTimeRange(const string& text, long long& lo, long long& hi) {
+    size_t dots = text.find("..");
+    if (dots != string::npos)
+        return parseTimeValue(text.substr(0, dots), lo) && parseTimeValue(text.substr(dots + 2), hi);
+
+    // ISO times contain ':' themselves, so try every split point
+    for (size_t colon = text.find(':'); colon != string::npos; colon = text.find(':', colon + 1)) {
+        if (parseTimeValue(text.substr(0, colon), lo) && parseTimeValue(text.substr(colon + 1), hi))
+            return true;
+    }
+    return false;
+}
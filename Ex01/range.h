@@ -0,0 +1,42 @@
+#pragma once
+#include "blockdb.h"
+
+// One key per block, sorted, with the matching block ids alongside.
+// Ties keep DB order.
+struct SortedColumn {
+    vector<long long> keys;
+    vector<uint32_t> ids;
+
+    // [first, last) positions whose key is in [lo, hi], by binary search
+    pair<size_t, size_t> range(long long lo, long long hi) const;
+};
+
+// Sorted height and time columns for range queries over a BlockDb. Worth
+// building where it is kept for many queries (the q5 menu, blockd); a single
+// query is cheaper with heightsInRange/timesInRange.
+class RangeIndex {
+public:
+    explicit RangeIndex(const BlockDb& db);
+
+    const SortedColumn& heights() const { return byHeight; }
+    const SortedColumn& times() const { return byTime; }
+
+private:
+    SortedColumn byHeight;
+    SortedColumn byTime;
+};
+
+// Only the blocks whose height (time) is in [lo, hi], sorted as a RangeIndex
+// column would be: one pass over the DB, then a sort of just the matches
+SortedColumn heightsInRange(const BlockDb& db, long long lo, long long hi);
+SortedColumn timesInRange(const BlockDb& db, long long lo, long long hi);
+
+// "A:B" with either end optional ("A:" or ":B"), inclusive
+bool parseHeightRange(const string& text, long long& lo, long long& hi);
+
+// Epoch seconds, "YYYY-MM-DD" (midnight UTC) or "YYYY-MM-DDTHH:MM:SSZ"
+bool parseTimeValue(const string& text, long long& value);
+
+// "T1:T2" inclusive, each end epoch seconds, "YYYY-MM-DD" or
+// "YYYY-MM-DDTHH:MM:SSZ"; "T1..T2" is accepted as well
+bool parseTimeRange(const string& text, long long& lo, long long& hi);
@@ -0,0 +1,286 @@
+#include "refresh.h"
+#include "block_view.h"
+#include "fetcher.h"
+#include "index.h"
+#include "printer.h"
+#include "snapshot.h"
+#include "stats.h"
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+
+static bool writeAll(int fd, string_view text) {
+    size_t done = 0;
+    while (done < text.size()) {
+        ssize_t n = write(fd, text.data() + done, text.size() - done);
+        if (n <= 0)
+            return false;
+        done += n;
+    }
+    return true;
+}
+
+// Opens path locked for writing, making sure the lock is on the file that is
+// current once it is granted. Returns -1 on failure.
+static int lockCurrent(const string& path, int flags) {
+    while (true) {
+        int fd = open(path.c_str(), flags | O_CREAT | O_CLOEXEC, 0644);
+        if (fd < 0)
+            return -1;
+        struct stat held, current;
+        if (flock(fd, LOCK_EX) != 0 || fstat(fd, &held) != 0) {
+            close(fd);
+            return -1;
+        }
+        if (stat(path.c_str(), &current) == 0 && current.st_dev == held.st_dev && current.st_ino == held.st_ino)
+            return fd;
+        close(fd);  // replaced while we waited
+    }
+}
+
+// Called with the blocks.txt lock held, which keeps bumps in order
+static void bumpGeneration() {
+    string tmp = GENERATION_FILE + ".tmp." + to_string(getpid());
+    {
+        ofstream file(tmp, ios::trunc);
+        file << blocksGeneration() + 1 << "\n";
+    }
+    rename(tmp.c_str(), GENERATION_FILE.c_str());
+}
+
+bool replaceBlocks(const vector<Block>& blocks, const string& path) {
+    int fd = lockCurrent(path, O_RDONLY);
+    if (fd < 0) {
+        print_error("Failed to open file: " + path + "\n");
+        return false;
+    }
+    bool ok = writeBlocksText(path, blocks);
+    if (ok)
+        bumpGeneration();
+    close(fd);  // drops the lock; writers waiting on the old file will retry
+    return ok;
+}
+
+// Height of the first record in the file fd refers to, which is the newest
+// one since blocks.txt is kept newest first. False if it holds no record.
+static bool firstRecordHeight(int fd, off_t size, long long& height) {
+    vector<char> head;
+    for (size_t want = 4096;; want *= 2) {
+        head.resize((size_t)min<off_t>(size, want));
+        ssize_t n = pread(fd, head.data(), head.size(), 0);
+        if (n < 0)
+            return false;
+        BlockView first;
+        if (parseRecordView(head.data(), head.data() + n, first)) {
+            height = first.height;
+            return true;
+        }
+        if ((off_t)n >= size)
+            return false;
+    }
+}
+
+bool prependBlocks(const vector<Block>& fetched, size_t* added, const string& path) {
+    if (added)
+        *added = 0;
+    int fd = lockCurrent(path, O_RDONLY);
+    if (fd < 0) {
+        print_error("Failed to open file: " + path + "\n");
+        return false;
+    }
+    struct stat before;
+    fstat(fd, &before);
+
+    // Another refresh may have stored some of these since the caller read
+    // the newest height; only what is still newer than the locked file goes in
+    vector<Block> blocks = fetched;
+    long long stored;
+    if (firstRecordHeight(fd, before.st_size, stored))
+        blocks.erase(find_if(blocks.begin(), blocks.end(), [&](const Block& b) { return b.height <= stored; }),
+                     blocks.end());
+    if (blocks.empty()) {
+        close(fd);
+        return true;
+    }
+
+    string text;
+    vector<PrependedRecord> records;
+    for (const Block& block : blocks) {
+        records.push_back({text.size(), block});
+        appendBlockText(text, block);
+        text += "\n";
+    }
+
+    // The new records, then the old text copied from the file we hold
+    // locked, published by rename like a full refresh
+    string tmp = path + ".tmp." + to_string(getpid());
+    int out = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    bool ok = out >= 0 && writeAll(out, text);
+    vector<char> buffer(1 << 20);
+    for (off_t done = 0; ok && done < before.st_size;) {
+        ssize_t n = pread(fd, buffer.data(), buffer.size(), done);
+        ok = n > 0 && writeAll(out, string_view(buffer.data(), n));
+        done += ok ? n : 0;
+    }
+    addStat(COUNT_BYTES_WRITTEN, ok ? text.size() + before.st_size : 0);
+    ok = ok && fsync(out) == 0;
+    ok = out >= 0 && close(out) == 0 && ok;
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+        remove(tmp.c_str());
+        close(fd);
+        print_error("Failed to write file: " + path + "\n");
+        return false;
+    }
+
+    struct stat after;
+    stat(path.c_str(), &after);
+
+    // Derived files that don't exist yet are left to be built on first use.
+    // Carried-forward ones are stamped with the generation this change is
+    // about to publish.
+    unsigned long long next = blocksGeneration() + 1;
+    bool reindex =
+        access(INDEX_FILE.c_str(), F_OK) == 0 && !prependIndex(INDEX_FILE, before, records, text.size(), after, next);
+    if (access(SNAPSHOT_FILE.c_str(), F_OK) == 0)
+        prependSnapshot(SNAPSHOT_FILE, before, blocks, after, next);  // a stale one is ignored and rewritten by load_db
+
+    bumpGeneration();
+    if (reindex) {
+        BlockIndex index;
+        index.open(INDEX_FILE, path);  // rebuilds, against the new generation
+    }
+    close(fd);  // drops the lock; writers waiting on the old file will retry
+    if (added)
+        *added = blocks.size();
+    return true;
+}
+
+bool newestStoredHeight(long long& height) {
+    BlockIndex index;
+    if (index.open() && index.newestHeight(height))
+        return true;
+
+    BlockTextFile text;
+    if (!text.open() || text.blocks().empty())
+        return false;
+    height = text.blocks().front().height;
+    for (const BlockView& view : text.blocks())
+        height = max<long long>(height, view.height);
+    return true;
+}
+
+bool appendNewBlocks(RefreshProgress& progress, string& message) {
+    long long newest, tip;
+    if (!newestStoredHeight(newest)) {
+        message = "No blocks stored yet; run a full refresh with a block count first";
+        return false;
+    }
+    if (!fetchTipHeight(tip)) {
+        message = "Failed to fetch the chain tip";
+        return false;
+    }
+    if (tip <= newest) {
+        message = "Already up to date at height " + to_string(newest);
+        return true;
+    }
+    progress.total = tip - newest;
+
+    // Each prepend rewrites blocks.txt, so batches double in size: the first
+    // blocks are queryable soon, and catching up on N costs O(log N) rewrites
+    size_t stored = 0;
+    size_t batch = REFRESH_BATCH;
+    for (long long low = newest + 1; low <= tip; low += batch, batch *= 2) {
+        long long high = min<long long>(tip, low + batch - 1);
+
+        // Newest first within a batch, like every other run of records in
+        // blocks.txt; each batch goes in front of the older one before it
+        vector<long long> heights;
+        for (long long h = high; h >= low; --h)
+            heights.push_back(h);
+
+        vector<Block> blocks;
+        size_t added;
+        if (!fetchBlocksByHeight(heights, blocks, &progress.fetched) || !prependBlocks(blocks, &added)) {
+            message = "Refresh stopped after " + to_string(progress.stored) + " of " + to_string(tip - newest) +
+                      " blocks";
+            return false;
+        }
+        progress.stored += blocks.size();  // queryable either way
+        stored += added;
+    }
+
+    message = "Added " + to_string(stored) + " blocks (heights " + to_string(newest + 1) + "-" + to_string(tip) + ")";
+    if (stored < (size_t)(tip - newest))
+        message += "; the rest were already stored by another refresh";
+    return true;
+}
+
+bool refreshDataIncremental() {
+    RefreshProgress progress;
+    string message;
+    bool ok = appendNewBlocks(progress, message);
+    if (ok)
+        print_output(message + "\n");
+    else
+        print_error(message + "\n");
+    return ok;
+}
+
+BackgroundRefresh::~BackgroundRefresh() {
+    if (worker.joinable())
+        worker.join();
+}
+
+bool BackgroundRefresh::start(int numBlocks) {
+    if (busy)
+        return false;
+    if (worker.joinable())
+        worker.join();  // the previous run, already finished
+
+    progress.total = numBlocks > 0 ? numBlocks : 0;
+    progress.fetched = 0;
+    progress.stored = 0;
+    busy = true;
+    worker = thread(&BackgroundRefresh::run, this, numBlocks);
+    return true;
+}
+
+void BackgroundRefresh::run(int numBlocks) {
+    ErrorCapture errors;  // reported with the outcome, not over the menu
+    string message;
+    if (numBlocks > 0) {
+        vector<Block> blocks;
+        if (fetchLatestBlocks(numBlocks, blocks, &progress.fetched) && replaceBlocks(blocks)) {
+            progress.stored = blocks.size();
+            message = "Replaced the DB with the newest " + to_string(blocks.size()) + " blocks";
+        } else {
+            message = "Refresh failed; the DB was left as it was";
+        }
+    } else {
+        appendNewBlocks(progress, message);
+    }
+
+    lock_guard<mutex> guard(lock);
+    outcome = "Last refresh: " + message;
+    string details = errors.text();
+    if (!details.empty() && details.back() == '\n')
+        details.pop_back();  // status() text carries no final newline
+    if (!details.empty())
+        outcome += "\n" + details;
+    busy = false;
+}
+
+string BackgroundRefresh::status() {
+    if (busy) {
+        string text = "Refreshing in the background: " + to_string(progress.fetched) + "/" +
+                      (progress.total ? to_string(progress.total) : string("?")) + " blocks fetched";
+        if (progress.stored)
+            text += ", " + to_string(progress.stored) + " already queryable";
+        return text;
+    }
+    lock_guard<mutex> guard(lock);
+    string text;
+    swap(text, outcome);
+    return text;
+}
@@ -0,0 +1,82 @@
+#pragma once
+#include "utils.h"
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+// Puts blocks (newest first) in front of the text DB, which keeps blocks.txt
+// newest first. Those at or below the newest stored height, as read under the
+// lock, are dropped, so overlapping refreshes don't store a height twice;
+// added, if given, receives how many went in. The new file is published by
+// rename as a whole (serialized with flock), and blocks.idx and blocks.snap
+// are carried forward to it instead of being left to a full rebuild.
+bool prependBlocks(const vector<Block>& blocks, size_t* added = nullptr, const string& path = BLOCKS_FILE);
+
+// Publishing a new blocks.txt.
+//
+// A full refresh never rewrites the file in place: the new text goes to a
+// temporary file that is renamed over blocks.txt. Readers that already have
+// the old file open or mapped keep reading that inode untouched, so they
+// neither block nor see torn data, and pick up the new file on their next
+// open. An incremental refresh publishes the same way, with the new records
+// written ahead of a copy of the old text.
+//
+// Writers take flock on the current blocks.txt; one that wakes up holding the
+// lock of a file that has since been replaced retries on the new one. Every
+// published change bumps GENERATION_FILE, under the same lock.
+
+// Replaces the text DB with blocks and returns false if it can't be written
+bool replaceBlocks(const vector<Block>& blocks, const string& path = BLOCKS_FILE);
+
+// Height of the newest stored block, from blocks.idx when it can answer
+bool newestStoredHeight(long long& height);
+
+// Counts a refresh publishes while it runs; read from any thread
+struct RefreshProgress {
+    atomic<size_t> total{0};    // blocks to fetch, once known
+    atomic<size_t> fetched{0};
+    atomic<size_t> stored{0};   // written to blocks.txt
+};
+
+// Blocks fetched for the first prepend of an incremental refresh; each
+// later batch is twice the one before
+const size_t REFRESH_BATCH = 64;
+
+// Fetches only the blocks above the newest stored height and prepends them
+// oldest batch first, starting at REFRESH_BATCH and doubling, so readers see
+// new blocks while the rest are still coming, an interrupted run leaves no
+// gap, every record is still followed by its parent, and a long catch-up
+// rewrites blocks.txt only O(log N) times. message receives the one-line
+// outcome.
+bool appendNewBlocks(RefreshProgress& progress, string& message);
+
+// appendNewBlocks() with its outcome printed, so a periodic refresh costs a
+// handful of requests.
+bool refreshDataIncremental();
+
+// One refresh at a time on a worker thread, for the q5 menu. Incremental
+// refreshes show up in blocks.txt batch by batch; a full refresh is
+// published in one piece when it completes (see replaceBlocks()).
+class BackgroundRefresh {
+public:
+    ~BackgroundRefresh();
+
+    // numBlocks > 0: replace the DB with the newest numBlocks blocks;
+    // 0: add what is newer than the stored blocks. False if one is running.
+    bool start(int numBlocks);
+    bool running() const { return busy; }
+
+    // "Refreshing: ..." while running, then the outcome of the last run
+    // followed by any errors it hit (once; empty afterwards and when there
+    // is nothing to report)
+    string status();
+
+private:
+    void run(int numBlocks);
+
+    thread worker;
+    atomic<bool> busy{false};
+    RefreshProgress progress;
+    mutex lock;
+    string outcome;  // guarded by lock
+};
@@ -0,0 +1,22 @@
+#include "resident_indexes.h"
+
+const RangeIndex& ResidentIndexes::ranges() {
+    call_once(rangesBuilt, [&] { rangeIndex.reset(new RangeIndex(db)); });
+    return *rangeIndex;
+}
+
+const TotalsColumn& ResidentIndexes::totals() {
+    const RangeIndex& index = ranges();
+    call_once(totalsBuilt, [&] { totalsColumn.reset(new TotalsColumn(db, index)); });
+    return *totalsColumn;
+}
+
+const HashPrefixIndex& ResidentIndexes::prefixes() {
+    call_once(prefixesBuilt, [&] { prefixIndex.reset(new HashPrefixIndex(db)); });
+    return *prefixIndex;
+}
+
+const ChainIndex& ResidentIndexes::chain() {
+    call_once(chainBuilt, [&] { chainIndex.reset(new ChainIndex(db)); });
+    return *chainIndex;
+}
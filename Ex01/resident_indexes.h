@@ -0,0 +1,37 @@
+#pragma once
+#include "blockdb.h"
+#include "range.h"
+#include "aggregate.h"
+#include "hash_prefix.h"
+#include "chain.h"
+#include <memory>
+#include <mutex>
+
+// The indexes built over one state of a BlockDb, for processes that keep the
+// DB loaded (the q5 menu, blockd). Each is built the first time it is asked
+// for and then reused by every later query, from any thread, until the DB
+// changes: a holder compares generation() with the DB's and makes a new
+// ResidentIndexes when they differ. The DB must outlive it and must not
+// change while it is in use.
+class ResidentIndexes {
+public:
+    explicit ResidentIndexes(const BlockDb& db) : db(db), builtFor(db.generation()) {}
+
+    // The BlockDb generation these indexes describe
+    unsigned long long generation() const { return builtFor; }
+
+    const RangeIndex& ranges();
+    const TotalsColumn& totals();
+    const HashPrefixIndex& prefixes();
+    const ChainIndex& chain();
+
+private:
+    const BlockDb& db;
+    unsigned long long builtFor;
+
+    once_flag rangesBuilt, totalsBuilt, prefixesBuilt, chainBuilt;
+    unique_ptr<RangeIndex> rangeIndex;
+    unique_ptr<TotalsColumn> totalsColumn;
+    unique_ptr<HashPrefixIndex> prefixIndex;
+    unique_ptr<ChainIndex> chainIndex;
+};
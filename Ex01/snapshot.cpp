@@ -0,0 +1,194 @@
+#include "snapshot.h"
+#include "stats.h"
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <unistd.h>
+
+static const char SNAPSHOT_MAGIC[8] = {'B', 'L', 'K', 'S', 'N', 'A', 'P', '\0'};
+
+static uint64_t align8(uint64_t n) {
+    return (n + 7) & ~uint64_t(7);
+}
+
+// Whether count elements of size bytes at off fit in a file of fileSize
+// bytes, starting on a multiple of align; written so nothing can overflow
+static bool sectionFits(uint64_t off, uint64_t count, uint64_t size, uint64_t align, uint64_t fileSize) {
+    return off % align == 0 && off <= fileSize && count <= (fileSize - off) / size;
+}
+
+long long mtimeNs(const struct stat& st) {
+    return (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+}
+
+bool Snapshot::open(const string& path, const struct stat& source) {
+    if (!file.open(path) || file.size() < sizeof(SnapshotHeader))
+        return false;
+
+    SnapshotHeader h;
+    memcpy(&h, file.data(), sizeof(h));
+    if (memcmp(h.magic, SNAPSHOT_MAGIC, sizeof(h.magic)) != 0 || h.version != SNAPSHOT_VERSION)
+        return false;
+    if (h.sourceSize != (uint64_t)source.st_size || h.sourceMtimeNs != mtimeNs(source) ||
+        h.sourceGeneration != blocksGeneration())
+        return false;
+
+    // Every section inside the file and every string inside the heap, so a
+    // truncated or corrupt snapshot is rejected instead of read out of bounds
+    uint64_t n = h.count, size = file.size();
+    if (!sectionFits(h.heightsOff, n, sizeof(int32_t), alignof(int32_t), size) ||
+        !sectionFits(h.totalsOff, n, sizeof(int64_t), alignof(int64_t), size) ||
+        !sectionFits(h.timesOff, n, sizeof(int64_t), alignof(int64_t), size) ||
+        !sectionFits(h.hashesOff, n, 32, 1, size) || !sectionFits(h.previousOff, n, 32, 1, size) ||
+        !sectionFits(h.timeTextOff, n, sizeof(StringRef), alignof(StringRef), size) ||
+        !sectionFits(h.relayedByOff, n, sizeof(StringRef), alignof(StringRef), size) ||
+        !sectionFits(h.heapOff, h.heapSize, 1, 1, size))
+        return false;
+
+    const char* base = file.data();
+    const StringRef* refs[2] = {reinterpret_cast<const StringRef*>(base + h.timeTextOff),
+                                reinterpret_cast<const StringRef*>(base + h.relayedByOff)};
+    for (const StringRef* column : refs)
+        for (uint64_t i = 0; i < n; ++i)
+            if ((uint64_t)column[i].offset + column[i].length > h.heapSize)
+                return false;
+
+    count = h.count;
+    heights = reinterpret_cast<const int32_t*>(base + h.heightsOff);
+    totals = reinterpret_cast<const int64_t*>(base + h.totalsOff);
+    times = reinterpret_cast<const int64_t*>(base + h.timesOff);
+    hashes = reinterpret_cast<const uint8_t*>(base + h.hashesOff);
+    previousHashes = reinterpret_cast<const uint8_t*>(base + h.previousOff);
+    timeRefs = reinterpret_cast<const StringRef*>(base + h.timeTextOff);
+    relayedRefs = reinterpret_cast<const StringRef*>(base + h.relayedByOff);
+    heap = base + h.heapOff;
+    heapSize = h.heapSize;
+    return true;
+}
+
+Block Snapshot::block(size_t i) const {
+    Block b;
+    b.hash = hashToHex(hash(i));
+    b.height = height(i);
+    b.total = total(i);
+    b.time = string(timeText(i));
+    b.relayed_by = string(relayedBy(i));
+    b.previous_block = hashToHex(previous(i));
+    return b;
+}
+
+// Writes blocks followed by base's blocks (if any). Old columns and heap are
+// copied as they are, just moved down the columns, and the new strings go
+// after the old heap, so extending a snapshot never re-encodes existing rows.
+static bool writeColumns(const string& path, const Snapshot* base, const vector<Block>& blocks,
+                         const struct stat& source, unsigned long long generation) {
+    const uint64_t old = base ? base->size() : 0;
+    const uint64_t added = blocks.size();
+    const uint64_t n = old + added;
+    const uint64_t oldHeap = base ? base->heapBytes() : 0;
+
+    SnapshotHeader h = {};
+    memcpy(h.magic, SNAPSHOT_MAGIC, sizeof(h.magic));
+    h.version = SNAPSHOT_VERSION;
+    h.count = n;
+    h.sourceSize = source.st_size;
+    h.sourceMtimeNs = mtimeNs(source);
+    h.sourceGeneration = generation;
+    h.heightsOff = align8(sizeof(h));
+    h.totalsOff = align8(h.heightsOff + n * sizeof(int32_t));
+    h.timesOff = h.totalsOff + n * sizeof(int64_t);
+    h.hashesOff = h.timesOff + n * sizeof(int64_t);
+    h.previousOff = h.hashesOff + n * 32;
+    h.timeTextOff = h.previousOff + n * 32;
+    h.relayedByOff = h.timeTextOff + n * sizeof(StringRef);
+    h.heapOff = h.relayedByOff + n * sizeof(StringRef);
+
+    h.heapSize = oldHeap;
+    for (const Block& b : blocks)
+        h.heapSize += b.time.size() + b.relayed_by.size();
+    // StringRef offsets are 32-bit; a larger heap is left to the text loader
+    if (h.heapSize > UINT32_MAX)
+        return false;
+
+    vector<char> out(h.heapOff + h.heapSize);
+    char* data = out.data();
+    uint64_t heapUsed = oldHeap;
+
+    if (base && old > 0) {
+        memcpy(data + h.heightsOff + added * sizeof(int32_t), base->heightsData(), old * sizeof(int32_t));
+        memcpy(data + h.totalsOff + added * sizeof(int64_t), base->totalsData(), old * sizeof(int64_t));
+        memcpy(data + h.timesOff + added * sizeof(int64_t), base->timesData(), old * sizeof(int64_t));
+        memcpy(data + h.hashesOff + added * 32, base->hash(0), old * 32);
+        memcpy(data + h.previousOff + added * 32, base->previous(0), old * 32);
+        memcpy(data + h.timeTextOff + added * sizeof(StringRef), base->timeRefsData(), old * sizeof(StringRef));
+        memcpy(data + h.relayedByOff + added * sizeof(StringRef), base->relayedRefsData(), old * sizeof(StringRef));
+        memcpy(data + h.heapOff, base->heapData(), oldHeap);
+    }
+
+    auto addString = [&](const string& s, StringRef* ref) {
+        ref->offset = (uint32_t)heapUsed;
+        ref->length = (uint32_t)s.size();
+        memcpy(data + h.heapOff + heapUsed, s.data(), s.size());
+        heapUsed += s.size();
+    };
+
+    for (uint64_t i = 0; i < added; ++i) {
+        const Block& b = blocks[i];
+        uint8_t* hash = reinterpret_cast<uint8_t*>(data + h.hashesOff + 32 * i);
+        uint8_t* prev = reinterpret_cast<uint8_t*>(data + h.previousOff + 32 * i);
+        if (!hexToHash(b.hash, hash) || !hexToHash(b.previous_block, prev))
+            return false;
+
+        int32_t height = b.height;
+        int64_t total = b.total;
+        long long epoch = 0;
+        parseTime(b.time, epoch);
+        int64_t time = epoch;
+        memcpy(data + h.heightsOff + i * sizeof(height), &height, sizeof(height));
+        memcpy(data + h.totalsOff + i * sizeof(total), &total, sizeof(total));
+        memcpy(data + h.timesOff + i * sizeof(time), &time, sizeof(time));
+
+        addString(b.time, reinterpret_cast<StringRef*>(data + h.timeTextOff) + i);
+        addString(b.relayed_by, reinterpret_cast<StringRef*>(data + h.relayedByOff) + i);
+    }
+    memcpy(data, &h, sizeof(h));
+
+    // Write next to the target and rename so readers never map a half-written file
+    string tmp = path + ".tmp." + to_string(getpid());
+    FILE* f = fopen(tmp.c_str(), "wb");
+    if (!f)
+        return false;
+    bool ok = fwrite(data, 1, out.size(), f) == out.size();
+    ok = (fclose(f) == 0) && ok;
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+        remove(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool writeSnapshot(const string& path, const vector<Block>& blocks, const struct stat& source) {
+    return writeColumns(path, nullptr, blocks, source, blocksGeneration());
+}
+
+bool prependSnapshot(const string& path, const struct stat& oldSource, const vector<Block>& added,
+                     const struct stat& newSource, unsigned long long newGeneration) {
+    Snapshot old;
+    if (!old.open(path, oldSource))
+        return false;
+    return writeColumns(path, &old, added, newSource, newGeneration);
+}
+
+bool loadSnapshot(const string& path, const struct stat& source, vector<Block>& blocks) {
+    Snapshot snap;
+    if (!snap.open(path, source))
+        return false;
+
+    ScopedTimer timer(TIMER_PARSE);
+    addStat(COUNT_BLOCKS_PARSED, snap.size());
+    blocks.clear();
+    blocks.reserve(snap.size());
+    for (size_t i = 0; i < snap.size(); ++i)
+        blocks.push_back(snap.block(i));
+    return true;
+}
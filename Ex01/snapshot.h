@@ -0,0 +1,105 @@
+#pragma once
+#include "utils.h"
+#include "mapped_file.h"
+
+// Binary, columnar copy of blocks.txt.
+//
+// Layout (all integers little endian, every section 8-byte aligned):
+//   SnapshotHeader
+//   int32_t   heights[count]
+//   int64_t   totals[count]
+//   int64_t   times[count]        epoch seconds, 0 if the text did not parse
+//   uint8_t   hashes[count][32]
+//   uint8_t   previous[count][32]
+//   StringRef timeText[count]     exact "time" text, into the heap
+//   StringRef relayedBy[count]    into the heap
+//   char      heap[heapSize]
+//
+// The header records the size and mtime of the blocks.txt it was built from
+// and the generation in blocks.gen at the time; a snapshot that does not
+// match the current file and generation is treated as stale.
+
+const uint32_t SNAPSHOT_VERSION = 2;
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t count;
+    uint64_t sourceSize;
+    int64_t sourceMtimeNs;
+    uint64_t sourceGeneration;
+    uint64_t heightsOff;
+    uint64_t totalsOff;
+    uint64_t timesOff;
+    uint64_t hashesOff;
+    uint64_t previousOff;
+    uint64_t timeTextOff;
+    uint64_t relayedByOff;
+    uint64_t heapOff;
+    uint64_t heapSize;
+};
+
+// Offsets are 32-bit, so a snapshot's heap is at most 4 GiB
+struct StringRef {
+    uint32_t offset;
+    uint32_t length;
+};
+
+class Snapshot {
+public:
+    // Maps the snapshot and validates it against the source file's stat.
+    bool open(const string& path, const struct stat& source);
+
+    size_t size() const { return count; }
+    int height(size_t i) const { return heights[i]; }
+    long long total(size_t i) const { return totals[i]; }
+    long long timeEpoch(size_t i) const { return times[i]; }
+    const uint8_t* hash(size_t i) const { return hashes + 32 * i; }
+    const uint8_t* previous(size_t i) const { return previousHashes + 32 * i; }
+    string_view timeText(size_t i) const { return str(timeRefs[i]); }
+    string_view relayedBy(size_t i) const { return str(relayedRefs[i]); }
+
+    Block block(size_t i) const;
+
+    // Raw sections, for copying a snapshot into a larger one
+    const int32_t* heightsData() const { return heights; }
+    const int64_t* totalsData() const { return totals; }
+    const int64_t* timesData() const { return times; }
+    const StringRef* timeRefsData() const { return timeRefs; }
+    const StringRef* relayedRefsData() const { return relayedRefs; }
+    const char* heapData() const { return heap; }
+    size_t heapBytes() const { return heapSize; }
+
+private:
+    string_view str(const StringRef& ref) const { return string_view(heap + ref.offset, ref.length); }
+
+    MappedFile file;
+    size_t count = 0;
+    const int32_t* heights = nullptr;
+    const int64_t* totals = nullptr;
+    const int64_t* times = nullptr;
+    const uint8_t* hashes = nullptr;
+    const uint8_t* previousHashes = nullptr;
+    const StringRef* timeRefs = nullptr;
+    const StringRef* relayedRefs = nullptr;
+    const char* heap = nullptr;
+    size_t heapSize = 0;
+};
+
+long long mtimeNs(const struct stat& st);
+
+// Writes blocks as a snapshot stamped with the source's stat. Returns false
+// (and writes nothing) if a hash is not 64 lowercase hex characters or the
+// string heap would not fit 32-bit StringRef offsets (over 4 GiB).
+bool writeSnapshot(const string& path, const vector<Block>& blocks, const struct stat& source);
+
+// Rewrites a snapshot that matched oldSource with added in front of its
+// rows, copying the existing columns instead of re-encoding them, and stamps
+// it for newSource and newGeneration. Returns false if the snapshot was
+// missing or stale, or added can't be stored.
+bool prependSnapshot(const string& path, const struct stat& oldSource, const vector<Block>& added,
+                     const struct stat& newSource, unsigned long long newGeneration);
+
+// Fills blocks from the snapshot if it is present and current.
+bool loadSnapshot(const string& path, const struct stat& source, vector<Block>& blocks);
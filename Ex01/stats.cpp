@@ -0,0 +1,117 @@
+#include "stats.h"
+#include "json_fields.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+std::atomic<bool> statsOn(false);
+
+static std::atomic<uint64_t> timerNs[TIMER_COUNT];
+static std::atomic<uint64_t> timerCalls[TIMER_COUNT];
+static std::atomic<uint64_t> counters[COUNT_COUNT];
+static uint64_t startNs = 0;
+static bool asJson = false;
+static std::string programName;
+
+static const char* const TIMER_NAMES[TIMER_COUNT] = {"open", "parse", "index_build", "cache_write",
+                                                      "lookup", "print", "export"};
+static const char* const COUNTER_NAMES[COUNT_COUNT] = {"bytes_read", "bytes_written", "blocks_parsed", "lookups",
+                                                      "probes", "cache_hits", "cache_misses", "bloom_rejects",
+                                                      "allocations", "allocated_bytes"};
+
+uint64_t statClockNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+void addStat(StatCounter counter, uint64_t n) {
+    if (statsEnabled())
+        counters[counter].fetch_add(n, std::memory_order_relaxed);
+}
+
+void addStatTime(StatTimer timer, uint64_t ns) {
+    timerNs[timer].fetch_add(ns, std::memory_order_relaxed);
+    timerCalls[timer].fetch_add(1, std::memory_order_relaxed);
+}
+
+void resetStats() {
+    for (int i = 0; i < TIMER_COUNT; ++i) {
+        timerNs[i] = 0;
+        timerCalls[i] = 0;
+    }
+    for (int i = 0; i < COUNT_COUNT; ++i)
+        counters[i] = 0;
+    startNs = statClockNs();
+}
+
+std::string formatStats(bool json) {
+    char line[160];
+    double wallMs = (statClockNs() - startNs) / 1e6;
+    std::string out;
+
+    if (json) {
+        out = "{\"program\": ";
+        appendJsonString(out, programName);
+        snprintf(line, sizeof(line), ", \"wall_ms\": %.3f, \"timers\": {", wallMs);
+        out += line;
+        for (int i = 0; i < TIMER_COUNT; ++i) {
+            snprintf(line, sizeof(line), "%s\"%s\": {\"ms\": %.3f, \"calls\": %llu}", i ? ", " : "", TIMER_NAMES[i],
+                     timerNs[i] / 1e6, (unsigned long long)timerCalls[i]);
+            out += line;
+        }
+        out += "}, \"counters\": {";
+        for (int i = 0; i < COUNT_COUNT; ++i) {
+            snprintf(line, sizeof(line), "%s\"%s\": %llu", i ? ", " : "", COUNTER_NAMES[i],
+                     (unsigned long long)counters[i]);
+            out += line;
+        }
+        return out + "}}\n";
+    }
+
+    snprintf(line, sizeof(line), ", %.3f ms wall ---\n", wallMs);
+    out = "--- stats: " + programName + line;
+    for (int i = 0; i < TIMER_COUNT; ++i) {
+        if (timerCalls[i] == 0)
+            continue;
+        snprintf(line, sizeof(line), "%-16s %12.3f ms %10llu calls\n", TIMER_NAMES[i], timerNs[i] / 1e6,
+                 (unsigned long long)timerCalls[i]);
+        out += line;
+    }
+    for (int i = 0; i < COUNT_COUNT; ++i) {
+        snprintf(line, sizeof(line), "%-16s %15llu\n", COUNTER_NAMES[i], (unsigned long long)counters[i]);
+        out += line;
+    }
+    return out;
+}
+
+void printStats() {
+    std::string text = formatStats(asJson);
+    fflush(stdout);
+    fputs(text.c_str(), stderr);
+}
+
+static void printStatsAtExit() {
+    printStats();
+}
+
+void parseStatsFlag(const std::string& program, int& argc, char* argv[]) {
+    int kept = 1;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--stats") == 0 || strcmp(argv[i], "--stats=json") == 0) {
+            asJson = argv[i][7] == '=';
+            statsOn = true;
+        } else {
+            argv[kept++] = argv[i];
+        }
+    }
+    argv[kept] = nullptr;
+    argc = kept;
+
+    if (statsOn) {
+        programName = program;
+        resetStats();
+        atexit(printStatsAtExit);
+    }
+}
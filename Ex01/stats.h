@@ -0,0 +1,69 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// Opt-in instrumentation: scoped timers and counters that cost a relaxed
+// load of one flag while --stats is off. Timers are inclusive, so a lookup
+// that prints counts towards both "lookup" and "print".
+
+enum StatTimer {
+    TIMER_OPEN,
+    TIMER_PARSE,
+    TIMER_INDEX_BUILD,
+    TIMER_CACHE_WRITE,  // storing blocks.snap for the next run
+    TIMER_LOOKUP,
+    TIMER_PRINT,
+    TIMER_EXPORT,
+    TIMER_COUNT
+};
+
+enum StatCounter {
+    COUNT_BYTES_READ,  // input mapped for reading, an upper bound on pages touched
+    COUNT_BYTES_WRITTEN,
+    COUNT_BLOCKS_PARSED,
+    COUNT_LOOKUPS,
+    COUNT_PROBES,
+    COUNT_CACHE_HITS,     // frames found decoded in the page cache
+    COUNT_CACHE_MISSES,   // frames decoded from disk
+    COUNT_BLOOM_REJECTS,  // hash lookups answered by the Bloom filter alone
+    COUNT_ALLOCATIONS,  // only in programs linked with alloc_stats.o
+    COUNT_ALLOCATED_BYTES,
+    COUNT_COUNT
+};
+
+extern std::atomic<bool> statsOn;
+
+inline bool statsEnabled() {
+    return statsOn.load(std::memory_order_relaxed);
+}
+
+void addStat(StatCounter counter, uint64_t n = 1);
+void addStatTime(StatTimer timer, uint64_t ns);
+uint64_t statClockNs();
+
+class ScopedTimer {
+public:
+    explicit ScopedTimer(StatTimer timer) : timer(timer), start(statsEnabled() ? statClockNs() : 0) {}
+    ~ScopedTimer() {
+        if (start)
+            addStatTime(timer, statClockNs() - start);
+    }
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+private:
+    StatTimer timer;
+    uint64_t start;
+};
+
+// Takes "--stats" (text summary) or "--stats=json" out of argv wherever it
+// appears and turns collection on; the summary goes to stderr at exit.
+void parseStatsFlag(const std::string& program, int& argc, char* argv[]);
+
+// The summary as text or as one JSON object, and a fresh start (for the q5
+// menu, which reports per choice)
+std::string formatStats(bool json);
+void printStats();
+void resetStats();
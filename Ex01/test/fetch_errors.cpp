@@ -0,0 +1,107 @@
+// A failed fetch must be reported through print_error on the thread that
+// asked for the blocks, so that a background refresh holding an ErrorCapture
+// shows it with its outcome instead of writing it over the q5 menu. Serves
+// 404 for every block from a local listener, fetches a few heights under an
+// ErrorCapture with stderr sent to a file, and checks that the file stays
+// empty and the capture holds the message.
+//
+// Usage: fetch_errors.out
+#include "../utils.h"
+#include "../fetcher.h"
+#include "../printer.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+using namespace std;
+
+static int failures = 0;
+
+static void check(bool ok, const string& what) {
+    if (!ok && failures++ < 20)
+        fprintf(stderr, "FAIL: %s\n", what.c_str());
+}
+
+// Answers every request with 404 until stop is set
+static void serveNotFound(int listener, const atomic<bool>& stop) {
+    static const char response[] = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+    while (!stop) {
+        int client = accept(listener, nullptr, nullptr);
+        if (client < 0)
+            continue;
+        char request[4096];
+        if (read(client, request, sizeof(request)) > 0 && write(client, response, sizeof(response) - 1) < 0)
+            perror("fetch_errors: write");
+        close(client);
+    }
+}
+
+int main() {
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(addr);
+    if (listener < 0 || bind(listener, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(listener, 16) != 0 ||
+        getsockname(listener, (sockaddr*)&addr, &length) != 0) {
+        perror("fetch_errors");
+        return 1;
+    }
+    atomic<bool> stop(false);
+    thread server(serveNotFound, listener, cref(stop));
+
+    string url = "http://127.0.0.1:" + to_string(ntohs(addr.sin_port));
+    setenv("BLOCKS_API_URL", url.c_str(), 1);
+    setenv("BLOCKS_FETCH_RATE", "0", 1);
+    setenv("BLOCKS_FETCH_CONCURRENCY", "4", 1);
+
+    // stderr goes to a file while the fetch runs
+    char errPath[] = "/tmp/fetch_errors.XXXXXX";
+    int errFile = mkstemp(errPath);
+    int savedErr = dup(2);
+    if (errFile < 0 || savedErr < 0) {
+        perror("fetch_errors");
+        return 1;
+    }
+    dup2(errFile, 2);
+
+    vector<Block> blocks;
+    bool fetched;
+    string captured;
+    {
+        ErrorCapture capture;
+        fetched = fetchBlocksByHeight({850000, 850001, 850002, 850003, 850004, 850005, 850006, 850007}, blocks);
+        captured = capture.text();
+    }
+
+    dup2(savedErr, 2);
+    close(savedErr);
+    off_t written = lseek(errFile, 0, SEEK_END);
+    close(errFile);
+    unlink(errPath);
+
+    check(!fetched, "the fetch fails");
+    check(written == 0, "nothing reaches stderr (" + to_string(written) + " bytes written)");
+    check(captured.rfind("Failed to fetch block ", 0) == 0 && captured.find("HTTP 404") != string::npos,
+          "the capture holds the failure: " + captured);
+    check(count(captured.begin(), captured.end(), '\n') == 1, "only the first failure is reported");
+
+    // Wake the listener so the server thread sees stop
+    stop = true;
+    shutdown(listener, SHUT_RDWR);
+    server.join();
+    close(listener);
+
+    if (failures) {
+        fprintf(stderr, "fetch_errors: %d checks failed\n", failures);
+        return 1;
+    }
+    printf("fetch_errors: ok\n");
+    return 0;
+}
@@ -0,0 +1,175 @@
+// An incremental refresh must leave blocks.txt newest first, so that q1's
+// arrows still run from each block to its parent. Stores part of a chain,
+// adds the rest batch by batch the way appendNewBlocks does, and after each
+// batch checks the text, blocks.snap, blocks.idx and a resident BlockDb
+// that follows the file, and that only the new records were parsed to get
+// there (nothing rebuilt from scratch), and that a batch overlapping what is
+// already stored adds only the missing blocks. Runs in a fresh temporary
+// directory.
+//
+// Usage: refresh_order.out
+#include "../utils.h"
+#include "../block_view.h"
+#include "../blockdb.h"
+#include "../index.h"
+#include "../refresh.h"
+#include "../snapshot.h"
+#include "../stats.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+
+using namespace std;
+
+static const long long FIRST_HEIGHT = 850000;
+static const long long STORED = 200;  // blocks written before the refresh
+static const long long ADDED = 150;   // blocks the refresh brings in
+
+static int failures = 0;
+
+static void check(bool ok, const string& what) {
+    if (!ok && failures++ < 20)
+        fprintf(stderr, "FAIL: %s\n", what.c_str());
+}
+
+// 64 hex chars derived from the height, with the leading zeros of a real hash
+static string blockHash(long long height) {
+    static const char digits[] = "0123456789abcdef";
+    string hash(16, '0');
+    uint64_t state = (uint64_t)height * 0x9e3779b97f4a7c15ULL;
+    while (hash.size() < 64) {
+        state ^= state >> 29;
+        state *= 0xbf58476d1ce4e5b9ULL;
+        hash += digits[state >> 60];
+    }
+    return hash;
+}
+
+static Block chainBlock(long long height) {
+    Block b;
+    b.hash = blockHash(height);
+    b.height = (int)height;
+    b.total = 1000000 + height;
+    b.time = formatTime(1700000000 + 600 * (height - FIRST_HEIGHT));
+    b.relayed_by = height % 3 ? "10.0.0." + to_string(height % 7) + ":8333" : "";
+    b.previous_block = blockHash(height - 1);
+    return b;
+}
+
+static bool sameBlock(const Block& a, const Block& b) {
+    return a.hash == b.hash && a.height == b.height && a.total == b.total && a.time == b.time &&
+           a.relayed_by == b.relayed_by && a.previous_block == b.previous_block;
+}
+
+static bool sameBlocks(const vector<Block>& a, const vector<Block>& b) {
+    return a.size() == b.size() && equal(a.begin(), a.end(), b.begin(), sameBlock);
+}
+
+// Blocks parsed since the last resetStats()
+static unsigned long long blocksParsed() {
+    string stats = formatStats(true);
+    size_t at = stats.find("\"blocks_parsed\": ");
+    return at == string::npos ? 0 : strtoull(stats.c_str() + at + 17, nullptr, 10);
+}
+
+// Newest first, heights high down to low
+static vector<Block> chainRange(long long high, long long low) {
+    vector<Block> blocks;
+    for (long long h = high; h >= low; --h)
+        blocks.push_back(chainBlock(h));
+    return blocks;
+}
+
+static void checkStored(long long newest, const BlockDb& resident, const string& when) {
+    vector<Block> expected = chainRange(newest, FIRST_HEIGHT);
+
+    // What q1 prints: every record followed by its parent
+    BlockTextFile text;
+    check(text.open(), when + ": blocks.txt opens");
+    const vector<BlockView>& views = text.blocks();
+    check(views.size() == expected.size(), when + ": blocks.txt holds " + to_string(expected.size()) + " blocks");
+    for (size_t i = 0; i < views.size() && i < expected.size(); ++i) {
+        string record = when + ": record " + to_string(i);
+        check(sameBlock(views[i].toBlock(), expected[i]), record + " is height " + to_string(expected[i].height));
+        if (i + 1 < views.size())
+            check(views[i].previous_block == views[i + 1].hash, record + " links to the next one");
+    }
+
+    // blocks.snap carried forward, not left stale
+    struct stat source;
+    stat(BLOCKS_FILE.c_str(), &source);
+    vector<Block> snapshot;
+    check(loadSnapshot(SNAPSHOT_FILE, source, snapshot) && sameBlocks(snapshot, expected),
+          when + ": blocks.snap is current");
+
+    BlockIndex index;
+    check(index.open(), when + ": blocks.idx opens");
+    for (const Block& b : expected) {
+        Block found;
+        uint8_t hash[32];
+        check(index.findByHeight(b.height, found) && sameBlock(found, b),
+              when + ": blocks.idx finds height " + to_string(b.height));
+        check(hexToHash(b.hash, hash) && index.findByHash(hash, found) && sameBlock(found, b),
+              when + ": blocks.idx finds " + b.hash);
+    }
+
+    check(resident.size() == expected.size(), when + ": the resident DB has every block");
+    for (size_t i = 0; i < resident.size() && i < expected.size(); ++i) {
+        check(sameBlock(resident.at(i), expected[i]), when + ": resident row " + to_string(i));
+        check(resident.indexOfHash(expected[i].hash) == i && resident.indexOfHeight(expected[i].height) == i,
+              when + ": resident lookups for row " + to_string(i));
+    }
+}
+
+int main() {
+    char dir[] = "/tmp/refresh_order.XXXXXX";
+    if (!mkdtemp(dir) || chdir(dir) != 0) {
+        perror("refresh_order");
+        return 1;
+    }
+
+    statsOn = true;
+    long long newest = FIRST_HEIGHT + STORED - 1;
+    check(replaceBlocks(chainRange(newest, FIRST_HEIGHT)), "the initial blocks.txt is written");
+    load_db();  // writes blocks.snap
+    BlockIndex built;
+    built.open();  // writes blocks.idx
+    BlockDb resident;
+    resident.refresh();
+    checkStored(newest, resident, "before the refresh");
+
+    // Oldest batch first, newest first within a batch, as appendNewBlocks fetches them
+    long long tip = newest + ADDED;
+    size_t batchSize = REFRESH_BATCH;
+    for (long long low = newest + 1; low <= tip; low += batchSize, batchSize *= 2) {
+        long long high = min<long long>(tip, low + batchSize - 1);
+        string batch = "blocks " + to_string(low) + "-" + to_string(high);
+        unsigned long long generation = resident.generation();
+        size_t added = 0;
+        resetStats();
+        check(prependBlocks(chainRange(high, low), &added) && added == (size_t)(high - low + 1), batch + " are added");
+        check(resident.refresh() && resident.generation() != generation, "the resident DB follows " + batch);
+        check(blocksParsed() == (unsigned long long)(high - low + 1), "only " + batch + " are parsed");
+        checkStored(high, resident, "after adding up to " + to_string(high));
+    }
+
+    // A refresh that read the newest height before another one stored the
+    // same blocks adds only what is still missing
+    size_t added = 1;
+    check(prependBlocks(chainRange(tip, tip - 9), &added) && added == 0, "stored blocks are not added again");
+    checkStored(tip, resident, "after re-adding stored blocks");
+    check(prependBlocks(chainRange(tip + 5, tip - 4), &added) && added == 5, "only the missing blocks are added");
+    resident.refresh();
+    checkStored(tip + 5, resident, "after an overlapping batch");
+
+    string cleanup = string("rm -rf ") + dir;
+    if (system(cleanup.c_str()) != 0)
+        fprintf(stderr, "could not remove %s\n", dir);
+    if (failures) {
+        fprintf(stderr, "refresh_order: %d checks failed\n", failures);
+        return 1;
+    }
+    printf("refresh_order: ok\n");
+    return 0;
+}
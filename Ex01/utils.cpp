@@ -1,55 +1,99 @@
 #include "utils.h"
+#include "stats.h"
 #include "printer.h" 
+#include "snapshot.h"
+#include "index.h"
+#include "block_view.h"
+#include "export.h"
+#include "fetcher.h"
+#include "output.h"
+#include "refresh.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <memory>
+#include <cstring>
+#include <cstdio>
 
 
+bool parseHeight(const string& value, long long& height) {
+    if (value.empty() || value.size() > 11)
+        return false;
+    try {
+        size_t used = 0;
+        height = stoll(value, &used);
+        return used == value.size() && to_string(height) == value;
+    } catch (const exception&) {
+        return false;
+    }
+}
+
 vector<Block> load_db() {
-    ifstream file("blocks.txt");
     vector<Block> blocks;
 
-    if (!file) {
+    // Prefer the binary snapshot when it was built from the current blocks.txt
+    struct stat source;
+    bool haveSource = stat(BLOCKS_FILE.c_str(), &source) == 0;
+    if (haveSource && loadSnapshot(SNAPSHOT_FILE, source, blocks))
+        return blocks;
+
+    BlockTextFile text;
+    if (!text.open(BLOCKS_FILE)) {
         print_error("Failed to open file: blocks.txt\n");
         return blocks;
     }
 
-    string line;
-    Block current;
-
-    while (getline(file, line)) {
-        if (line.rfind("hash: ", 0) == 0)
-            current.hash = line.substr(6);
-        else if (line.rfind("height: ", 0) == 0)
-            current.height = stoi(line.substr(8));
-        else if (line.rfind("total: ", 0) == 0)
-            current.total = stoll(line.substr(7));
-        else if (line.rfind("time: ", 0) == 0)
-            current.time = line.substr(6);
-        else if (line.rfind("relayed_by: ", 0) == 0)
-            current.relayed_by = line.substr(12);
-        else if (line.rfind("previous_block: ", 0) == 0) {
-            current.previous_block = line.substr(16);
-            blocks.push_back(current);  // Only push after full block is read
-        }
+    // Building the owning strings is the expensive part, so spread it too
+    const vector<BlockView>& views = text.blocks();
+    {
+        ScopedTimer timer(TIMER_PARSE);
+        blocks.resize(views.size());
+        parallelFor(views.size(), loadThreadCount(), [&](size_t first, size_t last) {
+            for (size_t i = first; i < last; ++i)
+                blocks[i] = views[i].toBlock();
+        });
+    }
+
+    // Cache for the next run; silently skipped if the data can't be stored in binary
+    if (haveSource) {
+        ScopedTimer timer(TIMER_CACHE_WRITE);
+        writeSnapshot(SNAPSHOT_FILE, blocks, source);
     }
 
     return blocks;
 }
 
 //print the db
-void printBlocks(const vector<Block>& blocks) {
-    for (size_t i = 0; i < blocks.size(); ++i) {
-        printBlock(blocks[i]);
+void printBlocks(const vector<Block>& blocks, bool paged) {
+    ScopedTimer timer(TIMER_PRINT);
+    unique_ptr<Pager> pager(paged ? new Pager() : nullptr);
+    OutputBuffer out(pager ? pager->fd() : STDOUT_FILENO);
+
+    for (size_t i = 0; i < blocks.size() && out.ok(); ++i) {
+        out.appendBlock(blocks[i]);
         if (i != blocks.size() - 1) {
-            print_output("|\n|\n|\nV\n");
+            out.append("|\n|\n|\nV\n");
         }
     }
+    out.flush();
 }
 
 // Prints block matching given hash or height.
 void findAndPrintBlockByField(const string& field, const string& value, vector<Block>& blocks) {
+    ScopedTimer timer(TIMER_LOOKUP);
+    addStat(COUNT_LOOKUPS);
+
+    // Compare heights as numbers instead of formatting every block's height
+    bool byHeight = field == "height";
+    long long height = 0;
+    if (byHeight && !parseHeight(value, height)) {
+        printNotFoundMessage(field, value);
+        return;
+    }
 
     for (const Block& block : blocks) {
-        if ((field == "hash" && block.hash == value) ||
-            (field == "height" && to_string(block.height) == value)) {
+        addStat(COUNT_PROBES);
+        if ((byHeight && block.height == height) ||
+            (!byHeight && field == "hash" && block.hash == value)) {
             printBlock(block);
             return;
         }
@@ -58,50 +102,41 @@ void findAndPrintBlockByField(const string& field, const string& value, vector<B
     printNotFoundMessage(field, value);
 }
 
-// Converts blocks.txt to a.csv
-void ExportTxtToCSV() {
-    std::ifstream inputFile("blocks.txt");
-    std::ofstream outputFile("blocks.csv");  // <-- writes to blocks.csv automatically
+// Answers a hash/height lookup from blocks.idx without loading the DB.
+// Returns false if the index can't give a definite answer; the caller then
+// falls back to findAndPrintBlockByField().
+bool findAndPrintBlockIndexed(const string& field, const string& value) {
+    ScopedTimer timer(TIMER_LOOKUP);
+    BlockIndex index;
+    if (!index.open())
+        return false;
 
-    if (!inputFile.is_open() || !outputFile.is_open()) {
-        print_error("Error opening input or output file!\n");
-        return;
+    Block block;
+    bool found;
+    if (field == "hash") {
+        uint8_t hash[32];
+        if (!hexToHash(value, hash) || !index.coversHashes())
+            return false;
+        found = index.findByHash(hash, block);
+    } else if (field == "height") {
+        long long height;
+        if (!index.coversHeights())
+            return false;
+        found = parseHeight(value, height) && index.findByHeight(height, block);
+    } else {
+        return false;
     }
 
-    std::vector<Block> blocks;
-    std::string line;
-    Block current;
-
-    while (std::getline(inputFile, line)) {
-        if (line.rfind("hash: ", 0) == 0)
-            current.hash = extractValue(line);
-        else if (line.rfind("height: ", 0) == 0)
-            current.height = std::stoi(extractValue(line));
-        else if (line.rfind("total: ", 0) == 0)
-            current.total = std::stoll(extractValue(line));
-        else if (line.rfind("time: ", 0) == 0)
-            current.time = extractValue(line);
-        else if (line.rfind("relayed_by: ", 0) == 0)
-            current.relayed_by = extractValue(line);
-        else if (line.rfind("previous_block: ", 0) == 0) {
-            current.previous_block = extractValue(line);
-            blocks.push_back(current);
-        }
-    }
-
-    inputFile.close();
-
-    outputFile << "hash,height,total,time,relayed_by,previous_block\n";
-    for (const Block& block : blocks) {
-        outputFile << block.hash << ","
-                   << block.height << ","
-                   << block.total << ","
-                   << block.time << ","
-                   << block.relayed_by << ","
-                   << block.previous_block << "\n";
-    }
+    if (found)
+        printBlock(block);
+    else
+        printNotFoundMessage(field, value);
+    return true;
+}
 
-    outputFile.close();
+// Converts blocks.txt to a.csv
+void ExportTxtToCSV() {
+    exportBlocks(ExportFormat::Csv);
 }
 
 // Extracts the value part from a "key: value" line
@@ -114,8 +149,147 @@ void ExportTxtToCSV() {
     return (firstNonSpace != std::string::npos) ? value.substr(firstNonSpace) : "";
 }
 
+unsigned long long blocksGeneration() {
+    ifstream file(GENERATION_FILE);
+    unsigned long long generation = 0;
+    file >> generation;
+    return generation;
+}
+
+bool writeBlocksText(const string& path, const vector<Block>& blocks) {
+    string text;
+    for (const Block& block : blocks) {
+        appendBlockText(text, block);
+        text += "\n";
+    }
+
+    // Written beside the target and renamed over it: anyone reading the old
+    // file keeps a complete copy, and nobody ever sees a partial new one
+    string tmp = path + ".tmp." + to_string(getpid());
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    bool ok = fd >= 0;
+    for (size_t done = 0; ok && done < text.size();) {
+        ssize_t n = write(fd, text.data() + done, text.size() - done);
+        ok = n > 0;
+        done += ok ? n : 0;
+    }
+    addStat(COUNT_BYTES_WRITTEN, ok ? text.size() : 0);
+    ok = ok && fsync(fd) == 0;
+    ok = fd >= 0 && close(fd) == 0 && ok;
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+        remove(tmp.c_str());
+        print_error("Failed to write file: " + path + "\n");
+        return false;
+    }
+    return true;
+}
+
+// Fetches the newest blocks over HTTP, newest first, and replaces blocks.txt
 void refreshData(int numBlocks) 
 {
-    string command = "./get_blocks.sh " + to_string(numBlocks);
-    system(command.c_str());
-}
\ No newline at end of file
+    vector<Block> blocks;
+    if (fetchLatestBlocks(numBlocks, blocks))
+        replaceBlocks(blocks);
+}
+
+const char* parseBlockRecord(const char* p, const char* end, Block& block) {
+    BlockView view;
+    const char* next = parseRecordView(p, end, view);
+    if (next)
+        block = view.toBlock();
+    return next;
+}
+
+bool hexToHash(string_view hex, uint8_t out[32]) {
+    if (hex.size() != 64)
+        return false;
+
+    for (size_t i = 0; i < 32; ++i) {
+        int byte = 0;
+        for (size_t j = 0; j < 2; ++j) {
+            char c = hex[2 * i + j];
+            int nibble;
+            if (c >= '0' && c <= '9')
+                nibble = c - '0';
+            else if (c >= 'a' && c <= 'f')
+                nibble = c - 'a' + 10;
+            else
+                return false;
+            byte = (byte << 4) | nibble;
+        }
+        out[i] = (uint8_t)byte;
+    }
+    return true;
+}
+
+string hashToHex(const uint8_t hash[32]) {
+    static const char digits[] = "0123456789abcdef";
+    string hex(64, '0');
+    for (size_t i = 0; i < 32; ++i) {
+        hex[2 * i] = digits[hash[i] >> 4];
+        hex[2 * i + 1] = digits[hash[i] & 0xf];
+    }
+    return hex;
+}
+
+// Days since 1970-01-01 for a proleptic Gregorian date
+static long long daysFromCivil(long long y, unsigned m, unsigned d) {
+    y -= m <= 2;
+    long long era = (y >= 0 ? y : y - 399) / 400;
+    unsigned yoe = (unsigned)(y - era * 400);
+    unsigned doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + (long long)doe - 719468;
+}
+
+static bool readDigits(string_view text, size_t pos, size_t count, int& value) {
+    if (pos + count > text.size())
+        return false;
+    value = 0;
+    for (size_t i = pos; i < pos + count; ++i) {
+        if (text[i] < '0' || text[i] > '9')
+            return false;
+        value = value * 10 + (text[i] - '0');
+    }
+    return true;
+}
+
+bool parseTime(string_view text, long long& epoch) {
+    int year, month, day, hour, minute, second;
+    if (!readDigits(text, 0, 4, year) || !readDigits(text, 5, 2, month) || !readDigits(text, 8, 2, day) ||
+        !readDigits(text, 11, 2, hour) || !readDigits(text, 14, 2, minute) || !readDigits(text, 17, 2, second))
+        return false;
+    if (text[4] != '-' || text[7] != '-' || (text[10] != 'T' && text[10] != ' ') || text[13] != ':' || text[16] != ':')
+        return false;
+    if (month < 1 || month > 12 || day < 1 || day > 31 || hour > 23 || minute > 59 || second > 60)
+        return false;
+
+    epoch = daysFromCivil(year, month, day) * 86400LL + hour * 3600LL + minute * 60LL + second;
+    return true;
+}
+
+string formatTime(long long epoch) {
+    long long days = epoch / 86400;
+    long long secs = epoch % 86400;
+    if (secs < 0) {
+        secs += 86400;
+        --days;
+    }
+
+    // Inverse of daysFromCivil
+    days += 719468;
+    long long era = (days >= 0 ? days : days - 146096) / 146097;
+    unsigned doe = (unsigned)(days - era * 146097);
+    unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    long long y = (long long)yoe + era * 400;
+    unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    unsigned mp = (5 * doy + 2) / 153;
+    unsigned d = doy - (153 * mp + 2) / 5 + 1;
+    unsigned m = mp < 10 ? mp + 3 : mp - 9;
+    y += m <= 2;
+
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%04lld-%02u-%02uT%02lld:%02lld:%02lldZ",
+             y, m, d, secs / 3600, (secs / 60) % 60, secs % 60);
+    return buf;
+}
@@ -4,7 +4,8 @@
 #include <sstream>
 #include <string>
 #include <vector>
-
+#include <string_view>
+#include <cstdint>
 
 using namespace std;
 
@@ -17,10 +18,41 @@ struct Block {
     string previous_block;
 };
 
+// Text DB written by get_blocks.sh and its binary snapshot cache
+const string BLOCKS_FILE = "blocks.txt";
+const string SNAPSHOT_FILE = "blocks.snap";
+// Counter bumped (by rename) every time a change to blocks.txt is published.
+// Files built from blocks.txt and resident DBs record it next to the file's
+// size and mtime, so a rewrite those miss still shows up as a new generation.
+const string GENERATION_FILE = "blocks.gen";
+
+// Number of changes published so far, 0 before the first
+unsigned long long blocksGeneration();
+
 vector<Block> load_db();
+// Writes blocks in the blocks.txt record format to a temporary file and
+// renames it over path
+bool writeBlocksText(const string& path, const vector<Block>& blocks);
 //void printBlock(const Block& block);
-void printBlocks(const std::vector<Block>& blocks);
+// paged: go through $PAGER when stdout is a terminal
+void printBlocks(const std::vector<Block>& blocks, bool paged = false);
 void findAndPrintBlockByField(const string& field, const string& value, vector<Block>& blocks);
+bool findAndPrintBlockIndexed(const string& field, const string& value);
  string extractValue(const string& rawLine);
 void ExportTxtToCSV();
-void refreshData(int numBlocks);
\ No newline at end of file
+void refreshData(int numBlocks);
+
+// Accepts exactly the strings to_string(int) produces, as a height lookup does
+bool parseHeight(const string& value, long long& height);
+
+// Parses one "key: value" record starting at p. Returns the position just past
+// its previous_block line, or nullptr if the text ends before the record does.
+const char* parseBlockRecord(const char* p, const char* end, Block& block);
+
+// 64 hex chars <-> 32 raw bytes. hexToHash fails on anything but lowercase hex.
+bool hexToHash(string_view hex, uint8_t out[32]);
+string hashToHex(const uint8_t hash[32]);
+
+// "YYYY-MM-DDTHH:MM:SS[.fff]Z" <-> seconds since the epoch (UTC)
+bool parseTime(string_view text, long long& epoch);
+string formatTime(long long epoch);